@@ -0,0 +1,307 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "deinterlacer.h"
+#include "frame_cache.h"
+#include "image_io.h"
+#include "trace.h"
+#include "work_stealing.h"
+
+namespace fs = std::filesystem;
+
+// Formats stb_image can load
+static bool is_image_file(const fs::path& path)
+{
+	auto extension = path.extension().string();
+
+	std::transform(extension.begin(),
+	               extension.end(),
+	               extension.begin(),
+	               [](const unsigned char c) { return (char)std::tolower(c); });
+
+	for (const auto supported :
+	     {".png", ".bmp", ".tga", ".jpg", ".jpeg", ".gif", ".pnm", ".ppm"}) {
+		if (extension == supported) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Input files sorted by name, so frames of a sequence stay in order. Fails
+// if two files would be written to the same output file (e.g. a.png and
+// a.jpg), as one would silently overwrite the other.
+static bool list_input_files(const std::string& in_dir,
+                             std::vector<fs::path>& files)
+{
+	std::error_code error;
+
+	for (const auto& entry : fs::directory_iterator(in_dir, error)) {
+		if (entry.is_regular_file() && is_image_file(entry.path())) {
+			files.emplace_back(entry.path());
+		}
+	}
+	if (error) {
+		fprintf(stderr,
+		        "Error reading input directory '%s': %s\n",
+		        in_dir.c_str(),
+		        error.message().c_str());
+		return false;
+	}
+	std::sort(files.begin(), files.end());
+
+	return check_output_file_names(files);
+}
+
+// Hash of the pixels and the size of an image; different seeds give
+// independent hashes
+static uint64_t hash_image(const std::vector<uint32_t>& pixels,
+                           const int width, const int height,
+                           const uint64_t seed)
+{
+	const uint64_t key[] = {hash_bytes(reinterpret_cast<const uint8_t*>(
+	                                           pixels.data()),
+	                                   pixels.size() * sizeof(uint32_t),
+	                                   seed),
+	                        (uint64_t)width,
+	                        (uint64_t)height};
+
+	return hash_bytes(reinterpret_cast<const uint8_t*>(key), sizeof(key));
+}
+
+// Seed of the second hash_image() hash of the batch dedupe
+constexpr uint64_t CheckHashSeed = 0x243f6a8885a308d3;
+
+// Makes `link` a hard link to `target`, or a copy of it where hard links
+// are not supported
+static bool link_or_copy(const fs::path& target, const fs::path& link)
+{
+	std::error_code error;
+
+	fs::remove(link, error);
+	fs::create_hard_link(target, link, error);
+
+	if (error) {
+		error.clear();
+		fs::copy_file(target,
+		              link,
+		              fs::copy_options::overwrite_existing,
+		              error);
+	}
+	return !error;
+}
+
+int run_batch(const std::string& in_dir, const std::string& out_dir,
+              const Strength strength, const int num_threads,
+              const bool reuse_mask, const bool dedupe)
+{
+	std::vector<fs::path> files;
+
+	if (!list_input_files(in_dir, files)) {
+		return EXIT_FAILURE;
+	}
+
+	std::error_code error;
+	fs::create_directories(out_dir, error);
+
+	if (error) {
+		fprintf(stderr,
+		        "Error creating output directory '%s': %s\n",
+		        out_dir.c_str(),
+		        error.message().c_str());
+		return EXIT_FAILURE;
+	}
+
+	const auto num_files = files.size();
+
+	const auto num_cores = std::max((int)std::thread::hardware_concurrency(),
+	                                1);
+	const auto num_workers = std::clamp((int)num_files, 1, num_cores);
+
+	// The workers already keep every core busy with a large batch, so the
+	// cores left over are split between the bands of each image instead of
+	// giving every worker as many band threads as there are cores
+	const auto max_bands = std::max(num_cores / num_workers, 1);
+
+	const auto threads_per_worker = (num_threads == 0)
+	                                      ? max_bands
+	                                      : std::min(num_threads, max_bands);
+
+	// Buffers reused for all files of a worker
+	struct Worker {
+		std::unique_ptr<Deinterlacer> deinterlacer = {};
+		std::vector<uint32_t> pixels               = {};
+	};
+
+	std::vector<Worker> workers(num_workers);
+
+	for (auto& worker : workers) {
+		worker.deinterlacer = std::make_unique<Deinterlacer>(0, 0);
+
+		worker.deinterlacer->set_strength(strength);
+		worker.deinterlacer->set_num_threads(threads_per_worker);
+		worker.deinterlacer->set_reuse_mask(reuse_mask);
+	}
+
+	// Output of every distinct image written so far, by hash_image().
+	// This doesn't use FrameCache: the images can differ in size, and a
+	// duplicate may repeat any earlier file, not just one of the last few.
+	// Keeping the path of the written file and linking to it needs no
+	// pixel storage at all.
+	//
+	// Without the pixels there's nothing to compare on a match, so a second
+	// hash with a different seed has to match too. Two different images
+	// are then only mistaken for each other if both 64-bit hashes collide,
+	// which is negligible next to the odds of a disk error, but not zero.
+	struct WrittenImage {
+		uint64_t check_hash = 0;
+		fs::path file       = {};
+	};
+
+	std::unordered_map<uint64_t, WrittenImage> written = {};
+	std::mutex written_mutex                           = {};
+
+	std::atomic<size_t> num_done = 0;
+	std::atomic<int> num_failed  = 0;
+	std::atomic<int> num_linked  = 0;
+
+	std::mutex progress_mutex = {};
+	auto last_percent         = -1;
+
+	auto report_progress = [&] {
+		const auto done    = ++num_done;
+		const auto percent = (int)(done * 100 / num_files);
+
+		std::lock_guard lock(progress_mutex);
+
+		if (percent != last_percent) {
+			printf("[%3d%%] %zu of %zu files\n", percent, done, num_files);
+			fflush(stdout);
+			last_percent = percent;
+		}
+	};
+
+	auto process_file = [&](Worker& worker, const fs::path& in_file,
+	                        const int64_t index) {
+		constexpr auto WriteComp = 4;
+
+		int width  = 0;
+		int height = 0;
+
+		bool loaded = false;
+		{
+			const TraceSpan span("decode", index);
+
+			loaded = load_image(in_file.string().c_str(),
+			                    worker.pixels,
+			                    width,
+			                    height);
+		}
+		if (!loaded) {
+			fprintf(stderr,
+			        "Error loading image file '%s'\n",
+			        in_file.string().c_str());
+			return false;
+		}
+		if (width % FrameWidthMultiple != 0) {
+			fprintf(stderr,
+			        "Unsupported width %d in '%s' (must be a "
+			        "multiple of 64)\n",
+			        width,
+			        in_file.string().c_str());
+			return false;
+		}
+
+		const auto out_file = fs::path(out_dir) /
+		                      output_file_name(in_file);
+
+		uint64_t hash       = 0;
+		uint64_t check_hash = 0;
+
+		if (dedupe) {
+			{
+				const TraceSpan span("hash", index);
+
+				hash       = hash_image(worker.pixels, width, height, 0);
+				check_hash = hash_image(worker.pixels,
+				                        width,
+				                        height,
+				                        CheckHashSeed);
+			}
+			fs::path original;
+			{
+				std::lock_guard lock(written_mutex);
+
+				const auto it = written.find(hash);
+				if (it != written.end() &&
+				    it->second.check_hash == check_hash) {
+					original = it->second.file;
+				}
+			}
+			if (!original.empty() && link_or_copy(original, out_file)) {
+				++num_linked;
+				return true;
+			}
+		}
+
+		const FrameView frame = {worker.pixels.data(), width, height, width};
+
+		{
+			const TraceSpan span("deinterlace", index);
+			worker.deinterlacer->process_in_place(frame);
+		}
+
+		const TraceSpan encode_span("encode", index);
+
+		if (!write_png(out_file.string().c_str(),
+		               width,
+		               height,
+		               WriteComp,
+		               worker.pixels.data(),
+		               width * WriteComp)) {
+			fprintf(stderr,
+			        "Error writing image file '%s'\n",
+			        out_file.string().c_str());
+			return false;
+		}
+
+		if (dedupe) {
+			std::lock_guard lock(written_mutex);
+			written.try_emplace(hash, WrittenImage{check_hash, out_file});
+		}
+		return true;
+	};
+
+	auto run_task = [&](const int worker, const size_t index) {
+		if (tracing_enabled()) {
+			set_trace_thread_name("worker " + std::to_string(worker));
+		}
+		if (!process_file(workers[worker], files[index], (int64_t)index)) {
+			++num_failed;
+		}
+		report_progress();
+	};
+
+	run_work_stealing(num_workers, num_files, run_task);
+
+	printf("Processed %zu files: %d failed", num_files, num_failed.load());
+	if (dedupe) {
+		printf(", %d duplicates linked", num_linked.load());
+	}
+	printf("\n");
+
+	return (num_failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,26 @@
+#ifndef FMV_DEINTERLACE_BATCH_H
+#define FMV_DEINTERLACE_BATCH_H
+
+#include <string>
+
+#include "stages.h"
+
+// Deinterlaces every image file in `in_dir` and writes them as PNG files
+// with the same names into `out_dir`. Nothing is written if two input files
+// map to the same output file, e.g. a.png and a.jpg.
+//
+// The files are independent, so they're spread over one worker per CPU core
+// with work stealing; each worker keeps its own Deinterlacer and image
+// buffer for all its files. Each image is split into at most `num_threads`
+// bands (0 = no limit), but only as many as there are cores left over by
+// the workers. With `dedupe`, a file whose pixels are the same as an
+// already written one becomes a hard link to it (or a copy where hard links
+// are not supported) instead of being deinterlaced and encoded again.
+//
+// Progress is printed to stdout, and files that fail are reported on stderr
+// without stopping the batch. Returns EXIT_FAILURE if there were any.
+int run_batch(const std::string& in_dir, const std::string& out_dir,
+              const Strength strength, const int num_threads,
+              const bool reuse_mask, const bool dedupe);
+
+#endif // FMV_DEINTERLACE_BATCH_H
@@ -0,0 +1,598 @@
+// Per-stage benchmark of the deinterlacing pipeline
+//
+// Every stage is timed on its own over a number of iterations after a few
+// warmup runs, and reported as min/median/p99/max and megapixels per second
+// (from the median). Only the stage call is inside the timed region; input
+// restoring, file I/O and everything else is outside of it.
+//
+// The frames are either image files, or synthetic frames generated from a
+// seed, which give the same workload on every machine and make it possible
+// to sweep the FMV coverage from an empty to a full mask.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "deinterlacer.h"
+#include "image_io.h"
+#include "perf_counters.h"
+#include "stages.h"
+#include "synthetic.h"
+
+// Benchmark results
+// =================
+// 10k iterations, averaged
+// 640x480 input image
+//
+//
+// 2024 MacMini, Apple M4
+// ----------------------
+//   uint8_t masks
+//       first implementation  1117 us
+//       threshold_8           1084 us
+//       downshift_and_xor_8   1058 us
+//       erode_vert_8           806 us
+//       dilate_vert_8          605 us
+//
+//  bitfield masks
+//       total                  155 us
+//
+//
+// AMD Ryzen 7900
+// --------------
+//   uint8_t masks
+//       first implementation  1454 us
+//
+//       threshold_8
+//       downshift_and_xor_8
+//       erode_vert_8
+//       dilate_vert_8          753 us
+//
+//  bitfield masks
+//       erode_horiz              5 us
+//       erode_vert             1.6 us
+//       dilate_horiz             5 us
+//       dilate_vert            1.6 us
+//       deinterlace             97 us
+//
+//       total                  220 us
+//
+//  kklobe changes
+//       total                   24 us
+
+// Width of the stage name column of the reports; fits the longest name,
+// "Deinterlacer (in place)"
+constexpr auto StageNameWidth = 24;
+
+struct BenchOptions {
+	int num_iterations = 1000;
+	int num_warmup     = 100;
+	int num_threads    = 1;
+
+	Strength strength = Strength::Subtle;
+
+	// Hardware counters of the timed iterations, if enabled and available
+	PerfCounters* perf = nullptr;
+};
+
+struct StageStats {
+	double min_ns    = 0;
+	double median_ns = 0;
+	double p99_ns    = 0;
+	double max_ns    = 0;
+};
+
+static StageStats compute_stats(std::vector<double>& durations_ns)
+{
+	std::sort(durations_ns.begin(), durations_ns.end());
+
+	const auto n = durations_ns.size();
+
+	// Nearest-rank percentiles
+	auto percentile = [&](const double p) {
+		const auto rank = (size_t)std::ceil(p / 100.0 * (double)n);
+		return durations_ns[std::clamp(rank, (size_t)1, n) - 1];
+	};
+
+	return {durations_ns.front(),
+	        percentile(50),
+	        percentile(99),
+	        durations_ns.back()};
+}
+
+// Counters of a stage per timed iteration
+struct StageCounters {
+	const char* name = nullptr;
+
+	PerfCounters::Counts counts = {};
+};
+
+// Ratio of two events, or a negative number if either is missing
+static double event_ratio(const PerfCounters::Counts& counts,
+                          const PerfCounters::Event numerator,
+                          const PerfCounters::Event denominator)
+{
+	if (!counts.has(numerator) || !counts.has(denominator) ||
+	    counts.values[denominator] == 0) {
+		return -1;
+	}
+	return counts.values[numerator] / counts.values[denominator];
+}
+
+static void print_counters(const std::vector<StageCounters>& stages)
+{
+	using Event = PerfCounters::Event;
+
+	printf("\n  %-*s %10s %10s %10s %10s %10s %10s\n",
+	       StageNameWidth,
+	       "counters (per run)",
+	       "cycles",
+	       "IPC",
+	       "br-misses",
+	       "br-miss%",
+	       "L1D-miss%",
+	       "LLC-miss%");
+
+	// Missing events are printed as dashes
+	auto print_value = [](const double value, const char* format) {
+		if (value < 0) {
+			printf(" %10s", "-");
+		} else {
+			printf(format, value);
+		}
+	};
+
+	for (const auto& stage : stages) {
+		const auto& counts = stage.counts;
+
+		printf("  %-*s", StageNameWidth, stage.name);
+
+		print_value(counts.values[Event::Cycles], " %10.0f");
+		print_value(event_ratio(counts, Event::Instructions, Event::Cycles),
+		            " %10.2f");
+		print_value(counts.values[Event::BranchMisses], " %10.1f");
+
+		const auto percent = [&](const Event misses, const Event total) {
+			const auto ratio = event_ratio(counts, misses, total);
+			return (ratio < 0) ? ratio : ratio * 100;
+		};
+
+		print_value(percent(Event::BranchMisses, Event::Branches), " %10.2f");
+		print_value(percent(Event::L1dReadMisses, Event::L1dReads), " %10.2f");
+		print_value(percent(Event::LlcMisses, Event::LlcReferences), " %10.2f");
+		printf("\n");
+	}
+}
+
+// Times `run` over the warmup and the timed iterations. `setup` runs before
+// every iteration outside of the timed region (e.g. to restore a frame
+// that's modified in place). The hardware counters, if any, only count the
+// timed iterations and are added to `counters`.
+static void time_stage(const char* name, const BenchOptions& options,
+                       const int num_pixels,
+                       const std::function<void()>& setup,
+                       const std::function<void()>& run,
+                       std::vector<StageCounters>& counters)
+{
+	using Clock = std::chrono::steady_clock;
+
+	std::vector<double> durations_ns;
+	durations_ns.reserve(options.num_iterations);
+
+	const auto perf = options.perf;
+
+	for (auto it = 0; it < options.num_warmup + options.num_iterations; ++it) {
+		if (setup) {
+			setup();
+		}
+
+		const auto timed = (it >= options.num_warmup);
+
+		if (perf && it == options.num_warmup) {
+			perf->reset();
+		}
+		if (perf && timed) {
+			perf->start();
+		}
+
+		const auto start = Clock::now();
+		run();
+		const auto end = Clock::now();
+
+		if (perf && timed) {
+			perf->stop();
+		}
+
+		if (timed) {
+			durations_ns.emplace_back(
+			        std::chrono::duration<double, std::nano>(end - start)
+			                .count());
+		}
+	}
+
+	if (perf) {
+		auto counts = perf->read();
+
+		for (auto& value : counts.values) {
+			if (value >= 0) {
+				value /= options.num_iterations;
+			}
+		}
+		counters.push_back({name, counts});
+	}
+
+	const auto stats = compute_stats(durations_ns);
+
+	const auto mpix_per_sec = (stats.median_ns > 0)
+	                                ? num_pixels / (stats.median_ns / 1000.0)
+	                                : 0.0;
+
+	printf("  %-*s %10.2f %10.2f %10.2f %10.2f %10.1f\n",
+	       StageNameWidth,
+	       name,
+	       stats.min_ns / 1000.0,
+	       stats.median_ns / 1000.0,
+	       stats.p99_ns / 1000.0,
+	       stats.max_ns / 1000.0,
+	       mpix_per_sec);
+}
+
+static void bench_frame(const std::vector<uint32_t>& image, const int width,
+                        const int height, const BenchOptions& options)
+{
+	const auto layout    = make_mask_layout(width, height);
+	const auto bufsize   = mask_buffer_size(layout, layout.height);
+	const auto num_words = (size_t)width / 64;
+	const auto num_occupancy_words = (size_t)(height + 63) / 64;
+
+	const auto num_pixels = width * height;
+
+	auto input = image;
+	std::vector<uint32_t> output(input.size());
+
+	const FrameView src  = {input.data(), width, height, width};
+	const FrameView dest = {output.data(), width, height, width};
+
+	MaskBuffer buffer1(bufsize, 0);
+	MaskBuffer buffer2(bufsize, 0);
+	MaskBuffer buffer3(bufsize, 0);
+
+	MaskBuffer xor_mask(bufsize, 0);
+	MaskBuffer opened_mask(bufsize, 0);
+	RowOccupancy xor_occupancy(num_occupancy_words, 0);
+	RowOccupancy opened_occupancy(num_occupancy_words, 0);
+
+	MaskBuffer prev_line(num_words, 0);
+	MaskBuffer open_lines(OpenMaskNumLines * num_words, 0);
+
+	RectScratch rect_scratch = {};
+	std::vector<Rect> rects  = {};
+
+	std::vector<StageCounters> counters = {};
+
+	auto restore_input = [&] {
+		std::copy(image.begin(), image.end(), input.begin());
+	};
+
+	printf("  %-*s %10s %10s %10s %10s %10s\n",
+	       StageNameWidth,
+	       "stage (us)",
+	       "min",
+	       "median",
+	       "p99",
+	       "max",
+	       "MPix/s");
+
+	// Individual stages; every stage reads the output of the previous one,
+	// which stays the same between iterations
+	time_stage("threshold", options, num_pixels, {}, [&] {
+		threshold(layout, src, buffer1);
+	}, counters);
+	time_stage("downshift_and_xor", options, num_pixels, {}, [&] {
+		downshift_and_xor(layout, buffer1, buffer2);
+	}, counters);
+	time_stage("erode_horiz", options, num_pixels, {}, [&] {
+		erode_horiz(layout, buffer2, buffer3);
+	}, counters);
+	time_stage("erode_vert", options, num_pixels, {}, [&] {
+		erode_vert(layout, buffer3, buffer1);
+	}, counters);
+	time_stage("dilate_horiz", options, num_pixels, {}, [&] {
+		dilate_horiz(layout, buffer1, buffer3);
+	}, counters);
+	time_stage("dilate_vert", options, num_pixels, {}, [&] {
+		dilate_vert(layout, buffer3, buffer1);
+	}, counters);
+
+	// Fused stages as run by the Deinterlacer
+	time_stage("threshold_and_xor", options, num_pixels, {}, [&] {
+		threshold_and_xor(layout,
+		                  src,
+		                  xor_mask,
+		                  xor_occupancy,
+		                  prev_line,
+		                  0,
+		                  height);
+	}, counters);
+	time_stage("open_mask", options, num_pixels, {}, [&] {
+		open_mask(layout,
+		          xor_mask,
+		          xor_occupancy,
+		          opened_mask,
+		          opened_occupancy,
+		          open_lines,
+		          height);
+	}, counters);
+	time_stage("find_occupied_rows", options, num_pixels, {}, [&] {
+		find_occupied_rows(layout, opened_mask, opened_occupancy, height);
+	}, counters);
+
+	// Blending
+	time_stage("deinterlace", options, num_pixels, {}, [&] {
+		deinterlace(layout,
+		            src,
+		            opened_mask,
+		            opened_occupancy,
+		            dest,
+		            options.strength);
+	}, counters);
+	time_stage("find_mask_rects", options, num_pixels, {}, [&] {
+		find_mask_rects(layout,
+		                opened_mask,
+		                opened_occupancy,
+		                height,
+		                rect_scratch,
+		                rects);
+	}, counters);
+
+	// Modifies the input, so it's restored before every run
+	time_stage("deinterlace_in_place", options, num_pixels, restore_input, [&] {
+		deinterlace_in_place(layout,
+		                     src,
+		                     opened_mask,
+		                     opened_occupancy,
+		                     options.strength);
+	}, counters);
+
+	// Whole pipeline
+	Deinterlacer deinterlacer(width, height);
+
+	deinterlacer.set_strength(options.strength);
+	deinterlacer.set_num_threads(options.num_threads);
+
+	restore_input();
+
+	time_stage("Deinterlacer (copy)", options, num_pixels, {}, [&] {
+		deinterlacer.process(src, dest);
+	}, counters);
+	time_stage("Deinterlacer (in place)", options, num_pixels, restore_input, [&] {
+		deinterlacer.process_in_place(src);
+	}, counters);
+
+	if (options.perf) {
+		print_counters(counters);
+	}
+}
+
+// FMV coverages of --sweep, from no FMV at all to a full screen video
+constexpr float SweepCoverages[] = {0.0f, 0.05f, 0.25f, 0.5f, 0.75f, 1.0f};
+
+static void print_usage()
+{
+	printf("Usage: deinterlace_bench [--iterations N] [--warmup N]\n"
+	       "                         [--threads N] [--strength S] INPUT...\n"
+	       "       deinterlace_bench [--iterations N] [--warmup N]\n"
+	       "                         [--threads N] [--strength S]\n"
+	       "                         [--seed N] [--fmv-rects N] [--coverage F]\n"
+	       "                         [--density F] [--no-ui] [--sweep]\n"
+	       "                         --synthetic WxH\n"
+	       "\n"
+	       "Both forms also take --perf.\n"
+	       "\n"
+	       "  --iterations N  Number of timed runs of each stage (default 1000)\n"
+	       "  --warmup N      Number of untimed runs before them (default 100)\n"
+	       "  --threads N     Number of bands of the whole pipeline runs\n"
+	       "                  (0 = one per CPU core, default 1)\n"
+	       "  --strength S    Deinterlacing strength: low, medium, high,\n"
+	       "                  subtle (default) or full\n"
+	       "  --synthetic WxH Benchmark a generated WxH frame with a black\n"
+	       "                  background, static UI and interlaced FMV\n"
+	       "  --seed N        Seed of the generated frame (default 1)\n"
+	       "  --fmv-rects N   Number of FMV rectangles (default 1)\n"
+	       "  --coverage F    Fraction of the frame covered by FMV, 0 to 1\n"
+	       "                  (default 0.25)\n"
+	       "  --density F     Fraction of non-black pixels on the video\n"
+	       "                  lines, 0 to 1 (default 0.9)\n"
+	       "  --no-ui         Leave out the static UI\n"
+	       "  --sweep         Benchmark frames with FMV coverages from 0 to 1\n"
+	       "                  instead of a single --coverage\n"
+	       "  --perf          Also report hardware performance counters per\n"
+	       "                  stage (Linux only; the worker threads of the\n"
+	       "                  whole pipeline runs are not counted)\n");
+}
+
+// A frame to benchmark
+struct Workload {
+	std::string name = {};
+
+	std::vector<uint32_t> image = {};
+
+	int width  = 0;
+	int height = 0;
+};
+
+static bool load_workload(const std::string& filename, Workload& workload)
+{
+	workload.name = filename;
+
+	if (!load_image(filename.c_str(),
+	                workload.image,
+	                workload.width,
+	                workload.height)) {
+		fprintf(stderr, "Error loading image file '%s'\n", filename.c_str());
+		return false;
+	}
+	if (workload.width % FrameWidthMultiple != 0) {
+		fprintf(stderr,
+		        "Unsupported width %d in '%s' (must be a multiple of 64)\n",
+		        workload.width,
+		        filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+static Workload make_synthetic_workload(const SyntheticFrameParams& params)
+{
+	Workload workload = {};
+
+	char name[128];
+	snprintf(name,
+	         sizeof(name),
+	         "synthetic (seed %u, %d FMV rects, coverage %.2f, "
+	         "density %.2f%s)",
+	         params.seed,
+	         params.num_fmv_rects,
+	         params.fmv_coverage,
+	         params.fmv_density,
+	         params.static_ui ? "" : ", no UI");
+
+	workload.name   = name;
+	workload.width  = params.width;
+	workload.height = params.height;
+
+	generate_synthetic_frame(params, workload.image);
+
+	return workload;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options = {};
+
+	std::vector<std::string> input_files;
+
+	SyntheticFrameParams synthetic = {};
+
+	auto use_synthetic = false;
+	auto sweep         = false;
+	auto use_perf      = false;
+
+	for (auto i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+
+		if (arg == "--iterations" && i + 1 < argc) {
+			options.num_iterations = atoi(argv[++i]);
+		} else if (arg == "--warmup" && i + 1 < argc) {
+			options.num_warmup = atoi(argv[++i]);
+		} else if (arg == "--threads" && i + 1 < argc) {
+			options.num_threads = atoi(argv[++i]);
+		} else if (arg == "--synthetic" && i + 1 < argc) {
+			const auto size = argv[++i];
+
+			const auto num_parsed = sscanf(size,
+			                               "%dx%d",
+			                               &synthetic.width,
+			                               &synthetic.height);
+
+			if (num_parsed != 2 || synthetic.width <= 0 ||
+			    synthetic.height <= 0 ||
+			    synthetic.width % FrameWidthMultiple != 0) {
+				fprintf(stderr,
+				        "Invalid synthetic frame size '%s' (the width "
+				        "must be a multiple of 64)\n",
+				        size);
+				return EXIT_FAILURE;
+			}
+			use_synthetic = true;
+		} else if (arg == "--seed" && i + 1 < argc) {
+			synthetic.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--fmv-rects" && i + 1 < argc) {
+			synthetic.num_fmv_rects = atoi(argv[++i]);
+		} else if (arg == "--coverage" && i + 1 < argc) {
+			synthetic.fmv_coverage = (float)atof(argv[++i]);
+		} else if (arg == "--density" && i + 1 < argc) {
+			synthetic.fmv_density = (float)atof(argv[++i]);
+		} else if (arg == "--no-ui") {
+			synthetic.static_ui = false;
+		} else if (arg == "--sweep") {
+			sweep = true;
+		} else if (arg == "--perf") {
+			use_perf = true;
+		} else if (arg == "--strength" && i + 1 < argc) {
+			if (!parse_strength(argv[++i], options.strength)) {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+		} else if (arg.starts_with("--")) {
+			print_usage();
+			return EXIT_FAILURE;
+		} else {
+			input_files.emplace_back(arg);
+		}
+	}
+
+	if (input_files.empty() == !use_synthetic || (sweep && !use_synthetic) ||
+	    options.num_iterations <= 0 || options.num_warmup < 0) {
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Workload> workloads;
+
+	for (const auto& filename : input_files) {
+		if (!load_workload(filename, workloads.emplace_back())) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (sweep) {
+		for (const auto coverage : SweepCoverages) {
+			auto params         = synthetic;
+			params.fmv_coverage = coverage;
+
+			workloads.emplace_back(make_synthetic_workload(params));
+		}
+	} else if (use_synthetic) {
+		workloads.emplace_back(make_synthetic_workload(synthetic));
+	}
+
+#ifndef NDEBUG
+	printf("Warning: not a release build, the timings are not representative\n\n");
+#endif
+
+	// Counters are often unavailable in containers and VMs, or restricted
+	// by perf_event_paranoid; the timings are still useful without them
+	std::unique_ptr<PerfCounters> perf = {};
+
+	if (use_perf) {
+		perf = std::make_unique<PerfCounters>();
+
+		if (perf->is_available()) {
+			options.perf = perf.get();
+		} else {
+			printf("Hardware performance counters are not available (%s)\n\n",
+			       perf->error().c_str());
+		}
+	}
+
+	for (const auto& workload : workloads) {
+		printf("%s: %dx%d, %d iterations (%d warmup)\n",
+		       workload.name.c_str(),
+		       workload.width,
+		       workload.height,
+		       options.num_iterations,
+		       options.num_warmup);
+
+		bench_frame(workload.image, workload.width, workload.height, options);
+		printf("\n");
+	}
+	return EXIT_SUCCESS;
+}
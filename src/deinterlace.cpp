@@ -1,531 +1,573 @@
-#include <chrono>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <vector>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
-int image_width;
-int image_height;
+#include "batch.h"
+#include "deinterlacer.h"
+#include "frame_cache.h"
+#include "image_io.h"
+#include "sequence.h"
+#include "stages.h"
+#include "trace.h"
+#include "y4m.h"
 
-// For storing RGBA pixel data
-std::vector<uint32_t> input_image;
+#define WRITE_PASSES
 
-// Number of uint64_t's between two consecutive rows
-int buffer_pitch;
+void write_buffer(const char* filename, const MaskLayout& layout,
+                  MaskBuffer& buf)
+{
+#ifdef WRITE_PASSES
+	constexpr auto WriteComp = 1;
 
-// Number of uint64_t's before the start of the actual image data in each row
-int buffer_offset = 2;
+	auto in_line = buf.data() + layout.offset + layout.pitch;
 
-bool load_image(const char* filename)
-{
-	int channels_in_file;
-
-	// Ask for RGBA pixels (uint32_t)
-	constexpr int DesiredChannels = 4;
-
-	uint8_t* data = stbi_load(filename,
-	                          &image_width,
-	                          &image_height,
-	                          &channels_in_file,
-	                          DesiredChannels);
-	if (!data) {
-		return false;
-	}
+	std::vector<uint8_t> out_buf(layout.width * layout.height);
+	auto out = out_buf.data();
 
-	const auto num_pixels = image_width * image_height;
-	input_image.resize(num_pixels);
-	std::memcpy(input_image.data(), data, num_pixels * DesiredChannels);
+	for (auto y = 0; y < layout.height; ++y) {
+		auto in = in_line;
 
-	return true;
-}
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			auto in_buf = *in;
 
-void threshold(std::vector<uint32_t>& src, std::vector<uint64_t>& dest)
-{
-	auto in       = src.data();
-	auto out_line = dest.data() + buffer_offset + buffer_pitch;
-
-	for (auto y = 0; y < image_height; ++y) {
-		auto out = out_line;
-
-		for (auto x = 0; x < image_width / 64; ++x) {
-			uint64_t out_buf = 0;
-
-			// Build the 64-bit mask 8 pixels at a time to reduce
-			// loop overhead.
-			for (auto n = 0; n < 8; ++n) {
-				// Make sure the alpha component is set to zero
-				constexpr auto mask = 0x00ffffff;
-
-				const auto a1 = in[0] & mask;
-				const auto a2 = in[1] & mask;
-				const auto a3 = in[2] & mask;
-				const auto a4 = in[3] & mask;
-				const auto a5 = in[4] & mask;
-				const auto a6 = in[5] & mask;
-				const auto a7 = in[6] & mask;
-				const auto a8 = in[7] & mask;
-
-				in += 8;
-
-				// Non-black pixels are set to 1 in the bit
-				// mask. We convert the pixels by row, top to
-				// down, left to right. When converting the
-				// first 64 pixels of a row, the LSB of the mask
-				// uint64_t is the first pixel, and the MSB is
-				// the 64th pixel.
-
-				const uint8_t bits = ((a1 != 0) << 0) |
-				                     ((a2 != 0) << 1) |
-				                     ((a3 != 0) << 2) |
-				                     ((a4 != 0) << 3) |
-				                     ((a5 != 0) << 4) |
-				                     ((a6 != 0) << 5) |
-				                     ((a7 != 0) << 6) |
-				                     ((a7 != 0) << 7);
-
-				out_buf |= (uint64_t)bits << (n * 8);
+			for (auto n = 0; n < 64; ++n) {
+				*out = (in_buf & 1) ? 0xff : 0;
+				++out;
+				in_buf >>= 1;
 			}
-			*out = out_buf;
-			++out;
+			++in;
 		}
-
-		out_line += buffer_pitch;
+		in_line += layout.pitch;
 	}
+
+	write_png(filename,
+	          layout.width,
+	          layout.height,
+	          WriteComp,
+	          out_buf.data(),
+	          layout.width);
+#endif
 }
 
-void downshift_and_xor(std::vector<uint64_t>& src, std::vector<uint64_t>& dest)
+// Runs the individual (unfused) stages on a frame and writes the mask after
+// each of them. This is only for looking at the intermediate passes; the
+// Deinterlacer runs the fused stages and never builds these buffers. See
+// deinterlace_bench for the timings of the stages.
+void write_passes(const FrameView& frame)
 {
-	// Copy src into dest as a starting point (less than 1 us)
-	dest = src;
+#ifdef WRITE_PASSES
+	const auto layout  = make_mask_layout(frame.width, frame.height);
+	const auto bufsize = mask_buffer_size(layout, layout.height);
 
-	auto in_line = src.data() + buffer_offset + buffer_pitch;
+	// Fill buffers with zeroes
+	MaskBuffer buffer1(bufsize, 0);
+	MaskBuffer buffer2(bufsize, 0);
+	MaskBuffer buffer3(bufsize, 0);
 
-	// Start writing from the second row
-	auto out_line = dest.data() + buffer_offset + buffer_pitch * 2;
+	threshold(layout, frame, buffer1);
 
-	for (auto y = 0; y < (image_height - 1); ++y) {
-		auto in  = in_line;
-		auto out = out_line;
+	write_buffer("out/threshold.png", layout, buffer1);
 
-		for (auto x = 0; x < image_width / 64; ++x) {
-			*out ^= *in;
-			++in;
-			++out;
-		}
+	// buffer 1 now contains the mask for the original image
+	// (off for black pixels, on for non-black pixels)
 
-		in_line += buffer_pitch;
-		out_line += buffer_pitch;
-	}
-}
+	downshift_and_xor(layout, buffer1, buffer2);
 
-void dilate_horiz(std::vector<uint64_t>& src, std::vector<uint64_t>& dest)
-{
-	auto in_line  = src.data() + buffer_pitch + 1;
-	auto out_line = dest.data() + buffer_pitch + 1;
-
-	for (auto y = 0; y < image_height; ++y) {
-		auto in  = in_line;
-		auto out = out_line;
-
-		// We process the input horizontally in 64-pixel chunks.
-		// This is the layout of a single chunk in an uint64_t:
-		//
-		//    bits         pixels
-		//
-		//    0-7    pixels N    to N+7
-		//    8-15   pixels N+8  to N+15
-		//   16-23   pixels N+16 to N+23
-		//    ...            ...
-		//   48-55   pixels N+48 to N+55
-		//   56-63   pixels N+56 to N+63
-		//
-		uint64_t curr = *in++;
-		uint64_t prev = 0;
-
-		for (auto x = 0; x < image_width / 64 + 1; ++x) {
-			const auto next = *in;
-			++in;
+	write_buffer("out/downshift_and_xor.png", layout, buffer2);
 
-			// "Shift in" the last pixel of the previous chunk
-			const auto prev_pixel63 = (prev & ((uint64_t)1 << 63)) >> 63;
-			const auto left_neighbours = (curr << 1) | prev_pixel63;
+	for (auto i = 0; i < 2; ++i) {
+		erode_horiz(layout, buffer2, buffer3);
+		erode_vert(layout, buffer3, buffer2);
+	}
 
-			// "Shift in" the firs pixel of the next chunk
-			const auto next_pixel1      = (next & 1) << 63;
-			const auto right_neighbours = next_pixel1 | curr >> 1;
+	write_buffer("out/erode.png", layout, buffer2);
 
-			*out = left_neighbours | curr | right_neighbours;
-			++out;
+	for (auto i = 0; i < 2; ++i) {
+		dilate_horiz(layout, buffer2, buffer3);
+		dilate_vert(layout, buffer3, buffer2);
+	}
 
-			prev = curr;
-			curr = next;
-		}
+	write_buffer("out/dilate.png", layout, buffer2);
 
-		in_line += buffer_pitch;
-		out_line += buffer_pitch;
-	}
+	// buffer 2 now contains the mask for the interlaced FMV area
+#endif
 }
 
-void dilate_vert(std::vector<uint64_t>& src, std::vector<uint64_t>& dest)
+// Number of distinct recent frames whose output is kept with --dedupe.
+// Captures usually repeat the previous frame, but a few more entries also
+// catch a video alternating between a handful of frames.
+constexpr auto DedupeCacheSize = 4;
+
+// Reads raw RGBA frames of a fixed size from stdin until EOF, and writes the
+// deinterlaced frames to stdout in the same format. All buffers are
+// allocated up front and reused for every frame.
+int run_stream(Deinterlacer& deinterlacer, const int width, const int height,
+               const bool in_place, const bool dedupe)
 {
-	auto in_line  = src.data() + buffer_offset + buffer_pitch;
-	auto out_line = dest.data() + buffer_offset + buffer_pitch;
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	const auto num_pixels = (size_t)width * height;
+	const auto frame_size = num_pixels * sizeof(uint32_t);
 
-	for (auto y = 0; y < image_height; ++y) {
-		auto in  = in_line;
-		auto out = out_line;
+	std::vector<uint32_t> input_frame(num_pixels);
+	std::vector<uint32_t> output_frame(in_place ? 0 : num_pixels);
 
-		for (auto x = 0; x < image_width / 64; ++x) {
-			const auto prev = *(in - buffer_pitch);
-			const auto curr = *in;
-			const auto next = *(in + buffer_pitch);
+	const FrameView input  = {input_frame.data(), width, height, width};
+	const FrameView output = {output_frame.data(), width, height, width};
 
-			*out = prev | curr | next;
+	FrameCache cache(dedupe ? frame_size : 0, dedupe ? DedupeCacheSize : 0);
 
-			++in;
-			++out;
+	const auto input_bytes = reinterpret_cast<const uint8_t*>(
+	        input_frame.data());
+
+	for (int64_t frame_index = 0;; ++frame_index) {
+		size_t num_read = 0;
+		{
+			const TraceSpan span("read_frame", frame_index);
+
+			num_read = fread(input_frame.data(),
+			                 sizeof(uint32_t),
+			                 num_pixels,
+			                 stdin);
+		}
+		if (num_read == 0 && feof(stdin)) {
+			return EXIT_SUCCESS;
+		}
+		if (num_read != num_pixels) {
+			fprintf(stderr,
+			        ferror(stdin) ? "Error reading input stream\n"
+			                      : "Truncated frame in input stream\n");
+			return EXIT_FAILURE;
 		}
 
-		in_line += buffer_pitch;
-		out_line += buffer_pitch;
-	}
-}
+		const void* result = in_place ? input_frame.data()
+		                              : output_frame.data();
 
-void erode_horiz(std::vector<uint64_t>& src, std::vector<uint64_t>& dest)
-{
-	auto in_line  = src.data() + buffer_pitch + 1;
-	auto out_line = dest.data() + buffer_pitch + 1;
-
-	for (auto y = 0; y < image_height; ++y) {
-		auto in  = in_line;
-		auto out = out_line;
-
-		// We process the input horizontally in 64-pixel chunks.
-		// This is the layout of a single chunk in an uint64_t:
-		//
-		//    bits         pixels
-		//
-		//    0-7    pixels N    to N+7
-		//    8-15   pixels N+8  to N+15
-		//   16-23   pixels N+16 to N+23
-		//    ...            ...
-		//   48-55   pixels N+48 to N+55
-		//   56-63   pixels N+56 to N+63
-		//
-		uint64_t curr = *in++;
-		uint64_t prev = 0;
-
-		for (auto x = 0; x < image_width / 64 + 1; ++x) {
-			const auto next = *in;
-			++in;
+		// The input must be hashed before processing, as the in-place mode
+		// overwrites it
+		uint64_t hash = 0;
+		if (dedupe) {
+			const TraceSpan span("hash", frame_index);
+			hash = hash_bytes(input_bytes, frame_size);
+		}
+		const auto cached_output = dedupe ? cache.find(hash, input_bytes)
+		                                  : nullptr;
 
-			// "Shift in" the last pixel of the previous chunk
-			const auto prev_pixel63 = (prev & ((uint64_t)1 << 63)) >> 63;
-			const auto left_neighbours = (curr << 1) | prev_pixel63;
+		if (cached_output) {
+			result = cached_output;
 
-			// "Shift in" the firs pixel of the next chunk
-			const auto next_pixel1      = (next & 1) << 63;
-			const auto right_neighbours = next_pixel1 | curr >> 1;
+		} else if (in_place) {
+			const TraceSpan span("deinterlace", frame_index);
 
-			*out = left_neighbours & curr & right_neighbours;
-			++out;
+			// Inserted first so the cache gets the unmodified input
+			const auto cache_output = dedupe ? cache.insert(hash, input_bytes)
+			                                 : nullptr;
 
-			prev = curr;
-			curr = next;
-		}
+			deinterlacer.process_in_place(input);
 
-		in_line += buffer_pitch;
-		out_line += buffer_pitch;
-	}
-}
+			if (cache_output) {
+				std::memcpy(cache_output, result, frame_size);
+			}
+		} else if (dedupe) {
+			const TraceSpan span("deinterlace", frame_index);
 
-void erode_vert(std::vector<uint64_t>& src, std::vector<uint64_t>& dest)
-{
-	auto in_line  = src.data() + buffer_offset + buffer_pitch;
-	auto out_line = dest.data() + buffer_offset + buffer_pitch;
+			// Deinterlace straight into the cache
+			const auto cache_output = cache.insert(hash, input_bytes);
 
-	for (auto y = 0; y < image_height; ++y) {
-		auto in  = in_line;
-		auto out = out_line;
+			const FrameView cached = {reinterpret_cast<uint32_t*>(cache_output),
+			                          width,
+			                          height,
+			                          width};
 
-		for (auto x = 0; x < image_width / 64; ++x) {
-			const auto prev = *(in - buffer_pitch);
-			const auto curr = *in;
-			const auto next = *(in + buffer_pitch);
+			deinterlacer.process(input, cached);
+			result = cache_output;
 
-			*out = prev & curr & next;
+		} else {
+			const TraceSpan span("deinterlace", frame_index);
 
-			++in;
-			++out;
+			deinterlacer.process(input, output);
 		}
 
-		in_line += buffer_pitch;
-		out_line += buffer_pitch;
-	}
-}
+		const TraceSpan write_span("write_frame", frame_index);
 
-// Deinterlacing strength params
-//
-// low     1 / 2
-// medium  2 / 3
-// high    4 / 5
-// subtle  8 / 9
-// full    1 / 1
+		const auto num_written = fwrite(result,
+		                                sizeof(uint32_t),
+		                                num_pixels,
+		                                stdout);
 
-static inline uint32_t scale_8_9_rgb(uint32_t color)
-{
-    // Replace /9 with mul+shift approx to avoid divides:
-    // 227/256 ≈ 0.8867 ~ 8/9 (0.8889). Good enough for video.
-    auto scale = [](uint32_t c) -> uint32_t {
-        return (c * 227 + 128) >> 8; // 0..255
-    };
-
-    const auto r =  scale( color        & 0xff);
-    const auto g = (scale((color >> 8)  & 0xff) << 8);
-    const auto b = (scale((color >> 16) & 0xff) << 16);
-    return r | g | b;
+		if (num_written != num_pixels || fflush(stdout) != 0) {
+			fprintf(stderr, "Error writing output stream\n");
+			return EXIT_FAILURE;
+		}
+	}
 }
 
-void apply_masked_bleed_64(uint64_t m, const uint32_t* in, uint32_t* out)
+// Reads a YUV4MPEG2 stream from stdin and writes the deinterlaced stream to
+// stdout. The mask is built from the luma plane, and every frame is
+// deinterlaced in place in the same reused buffer.
+int run_y4m_stream(const Strength strength, const int num_threads,
+                   const bool reuse_mask, const bool dedupe)
 {
-    while (m) {
-        const auto k = std::countr_zero(m);
-        const auto in_buf = in[k];
-        const auto scaled = scale_8_9_rgb(in_buf);
-        out[k] |= scaled;
-
-        m &= (m - 1); // clear lowest set bit
-    }
-}
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	Y4mStream stream = {};
 
-void deinterlace(std::vector<uint32_t>& src, std::vector<uint64_t>& mask,
-                 std::vector<uint32_t>& dest)
-{
-	dest = src;
+	if (!read_y4m_header(stdin, stream)) {
+		return EXIT_FAILURE;
+	}
 
-	auto in        = src.data();
-	auto mask_line = mask.data() + buffer_offset + buffer_pitch * 2;
-	auto out       = dest.data() + image_width;
+	Deinterlacer deinterlacer(stream.width, stream.height);
 
-	for (auto y = 0; y < (image_height - 1); ++y) {
-		auto mask = mask_line;
+	deinterlacer.set_strength(strength);
+	deinterlacer.set_num_threads(num_threads);
+	deinterlacer.set_reuse_mask(reuse_mask);
 
-		for (auto x = 0; x < image_width / 64; ++x) {
-			const uint64_t m = mask[x];
-			if (m) {
-				// 64 pixels = 64 uint32_t
-				apply_masked_bleed_64(m, in + x * 64, out + x * 64);
-			}
-		}
+	std::vector<uint8_t> frame_data(y4m_frame_size(stream));
+	std::string frame_header;
+
+	const auto frame = y4m_frame_view(stream, frame_data);
 
-		in += image_width;
-		out += image_width;
+	const auto frame_size = frame_data.size();
 
-		mask_line += buffer_pitch;
+	FrameCache cache(dedupe ? frame_size : 0, dedupe ? DedupeCacheSize : 0);
+
+	if (!write_y4m_header(stdout, stream)) {
+		fprintf(stderr, "Error writing output stream\n");
+		return EXIT_FAILURE;
 	}
-}
 
-#define WRITE_PASSES
+	for (int64_t frame_index = 0;; ++frame_index) {
+		auto result = Y4mReadResult::Error;
+		{
+			const TraceSpan span("read_frame", frame_index);
 
-void write_buffer(const char* filename, std::vector<uint64_t>& buf)
-{
-#ifdef WRITE_PASSES
-	constexpr auto WriteComp = 1;
+			result = read_y4m_frame(stdin, stream, frame_header, frame_data);
+		}
+		if (result == Y4mReadResult::EndOfStream) {
+			return EXIT_SUCCESS;
+		}
+		if (result == Y4mReadResult::Error) {
+			return EXIT_FAILURE;
+		}
 
-	auto in_line = buf.data() + buffer_offset + buffer_pitch;
+		uint64_t hash = 0;
+		if (dedupe) {
+			const TraceSpan span("hash", frame_index);
+			hash = hash_bytes(frame_data.data(), frame_size);
+		}
+		const auto cached_output = dedupe ? cache.find(hash, frame_data.data())
+		                                  : nullptr;
 
-	std::vector<uint8_t> out_buf(image_width * image_height);
-	auto out = out_buf.data();
+		if (cached_output) {
+			std::memcpy(frame_data.data(), cached_output, frame_size);
+		} else {
+			const TraceSpan span("deinterlace", frame_index);
 
-	for (auto y = 0; y < image_height; ++y) {
-		auto in = in_line;
+			// Inserted first so the cache gets the unmodified input
+			const auto cache_output = dedupe ? cache.insert(hash,
+			                                                frame_data.data())
+			                                 : nullptr;
 
-		for (auto x = 0; x < image_width / 64; ++x) {
-			auto in_buf = *in;
+			deinterlacer.process_in_place(frame);
 
-			for (auto n = 0; n < 64; ++n) {
-				*out = (in_buf & 1) ? 0xff : 0;
-				++out;
-				in_buf >>= 1;
+			if (cache_output) {
+				std::memcpy(cache_output, frame_data.data(), frame_size);
 			}
-			++in;
 		}
-		in_line += buffer_pitch;
-	}
 
-	stbi_write_png(filename,
-	               image_width,
-	               image_height,
-	               WriteComp,
-	               out_buf.data(),
-	               image_width);
-#endif
+		const TraceSpan write_span("write_frame", frame_index);
+
+		if (!write_y4m_frame(stdout, frame_header, frame_data) ||
+		    fflush(stdout) != 0) {
+			fprintf(stderr, "Error writing output stream\n");
+			return EXIT_FAILURE;
+		}
+	}
 }
 
-int main(int argc, char* argv[])
+// Deinterlaces a single image into out/output.png, and writes the
+// intermediate masks next to it
+int run_image(const char* input_file, const Strength strength,
+              const int num_threads, const bool find_rects, const bool in_place)
 {
-	if (argc <= 1) {
-		printf("Usage: deinterlace INPUT\n");
-		exit(EXIT_FAILURE);
-	}
+	// For storing RGBA pixel data
+	std::vector<uint32_t> input_image;
 
-	const auto input_file = argv[1];
+	int image_width  = 0;
+	int image_height = 0;
 
-	if (!load_image(input_file)) {
+	bool loaded = false;
+	{
+		const TraceSpan span("decode");
+		loaded = load_image(input_file, input_image, image_width, image_height);
+	}
+	if (!loaded) {
 		fprintf(stderr, "Error loading image file '%s'\n", input_file);
-		exit(EXIT_FAILURE);
+		return EXIT_FAILURE;
 	}
 
-	assert(image_width % 8 == 0);
-
-	// We store 64 1-bit pixels per uint64_t, plus 1 uint64_t for padding at
-	// the end of each row. We also store two padding rows at the top and
-	// bottom.
-	const auto bufsize = (image_width / 64 + buffer_offset) * (image_height + 2);
-
-	buffer_pitch = image_width / 64 + buffer_offset;
-
-	// Fill buffers with zeroes
-	std::vector<uint64_t> buffer1(bufsize, 0);
-	std::vector<uint64_t> buffer2(bufsize, 0);
-	std::vector<uint64_t> buffer3(bufsize, 0);
+	if (image_width % FrameWidthMultiple != 0) {
+		fprintf(stderr,
+		        "Unsupported width %d in '%s' (must be a multiple of 64)\n",
+		        image_width,
+		        input_file);
+		return EXIT_FAILURE;
+	}
 
 	std::vector<uint32_t> output_image(input_image.size());
 
-	std::vector<uint64_t> durations_ns;
+	const FrameView input  = {input_image.data(),
+	                          image_width,
+	                          image_height,
+	                          image_width};
+	const FrameView output = {output_image.data(),
+	                          image_width,
+	                          image_height,
+	                          image_width};
 
-	constexpr auto NumIterations = 1;
-//	constexpr auto NumIterations = 200;
+	write_passes(input);
 
-	// for benchmarking
-//	constexpr auto NumIterations = 200;
+	Deinterlacer deinterlacer(image_width, image_height);
 
-	// for benchmarking
-//	srand(time(NULL));
+	deinterlacer.set_strength(strength);
+	deinterlacer.set_num_threads(num_threads);
+	deinterlacer.set_find_rects(find_rects);
 
-	for (auto it = 0; it < NumIterations; ++it) {
+	{
+		const TraceSpan span("deinterlace");
 
-		// for benchmarking
-		// for (auto& x : input_image) {
-		// 	x = rand();
-		// }
+		if (in_place) {
+			deinterlacer.process_in_place(input);
+		} else {
+			deinterlacer.process(input, output);
+		}
+	}
 
-		auto start = std::chrono::high_resolution_clock::now();
-#if 1
-		// 33 us
-		threshold(input_image, buffer1);
+	constexpr auto WriteComp = 4;
 
-		write_buffer("out/threshold.png", buffer1);
+	const auto& result = in_place ? input_image : output_image;
+	{
+		const TraceSpan span("encode");
 
-		// buffer 1 now contains the mask for the original image
-		// (off for black pixels, on for non-black pixels)
-#endif
-#if 1
-		// 1.51 us
-		downshift_and_xor(buffer1, buffer2);
+		write_png("out/output.png",
+		          image_width,
+		          image_height,
+		          WriteComp,
+		          result.data(),
+		          image_width * WriteComp);
+	}
 
-		write_buffer("out/downshift_and_xor.png", buffer2);
-#endif
-#if 1
-		for (auto i = 0; i < 2; ++i) {
-			// 1.92 us
-			erode_horiz(buffer2, buffer3);
+	for (const auto& rect : deinterlacer.rects()) {
+		printf("FMV region: %dx%d at %d,%d\n",
+		       rect.width,
+		       rect.height,
+		       rect.x,
+		       rect.y);
+	}
+	return EXIT_SUCCESS;
+}
 
-			// 1.44 us
-			erode_vert(buffer3, buffer2);
+int main(int argc, char* argv[])
+{
+	auto print_usage = [] {
+		printf("Usage: deinterlace [--threads N | --rects] [--strength S]\n"
+		       "                   [--in-place] INPUT\n"
+		       "       deinterlace [--threads N] [--strength S] [--in-place]\n"
+		       "                   [--reuse-mask] [--dedupe]\n"
+		       "                   --stream WxH\n"
+		       "       deinterlace [--threads N] [--strength S] [--reuse-mask]\n"
+		       "                   [--dedupe] --y4m\n"
+		       "       deinterlace [--threads N] [--strength S] [--reuse-mask]\n"
+		       "                   --sequence OUT_DIR INPUT...\n"
+		       "       deinterlace [--threads N] [--strength S] [--reuse-mask]\n"
+		       "                   [--dedupe] --batch IN_DIR OUT_DIR\n"
+		       "\n"
+		       "  --threads N   Process the frame in N horizontal bands in\n"
+		       "                parallel (0 = one per CPU core)\n"
+		       "  --rects       Print the bounding rectangles of the detected\n"
+		       "                FMV regions of INPUT (single-threaded only)\n"
+		       "  --strength S  Deinterlacing strength: low (1/2), medium (2/3),\n"
+		       "                high (4/5), subtle (8/9, default) or full (1/1)\n"
+		       "  --in-place    Deinterlace the input frame in place instead of\n"
+		       "                copying it first\n"
+		       "  --stream WxH  Read raw WxH RGBA frames from stdin and write\n"
+		       "                the deinterlaced frames to stdout\n"
+		       "  --y4m         Read a YUV4MPEG2 stream (8-bit 4:2:0 or 4:4:4)\n"
+		       "                from stdin and write the deinterlaced stream\n"
+		       "                to stdout\n"
+		       "  --sequence OUT_DIR\n"
+		       "                Deinterlace the frames of a sequence of image\n"
+		       "                files in order, and write them as PNG files\n"
+		       "                into OUT_DIR; decoding, deinterlacing and\n"
+		       "                encoding run in parallel\n"
+		       "  --batch IN_DIR OUT_DIR\n"
+		       "                Deinterlace all images in IN_DIR in parallel,\n"
+		       "                and write them as PNG files into OUT_DIR\n"
+		       "  --reuse-mask  Only recompute the mask where the frame has\n"
+		       "                changed since the previous one (not with a\n"
+		       "                single INPUT)\n"
+		       "  --dedupe      Reuse the output of recent identical input\n"
+		       "                frames (--stream and --y4m), or hard link\n"
+		       "                identical images to each other (--batch)\n"
+		       "  --trace FILE  Write a timeline of the stages run by every\n"
+		       "                thread to FILE as Chrome trace event JSON\n"
+		       "                (open it in ui.perfetto.dev)\n");
+	};
+
+	std::vector<std::string> input_files = {};
+
+	const char* sequence_dir  = nullptr;
+	const char* batch_in_dir  = nullptr;
+	const char* batch_out_dir = nullptr;
+	const char* trace_file    = nullptr;
+
+	auto num_threads       = 1;
+	auto find_rects        = false;
+	auto strength          = Strength::Subtle;
+	auto in_place          = false;
+	auto stream_width      = 0;
+	auto stream_height     = 0;
+	auto y4m               = false;
+	auto reuse_mask        = false;
+	auto dedupe            = false;
+
+	for (auto i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+
+		if (arg == "--threads" && i + 1 < argc) {
+			num_threads = atoi(argv[++i]);
+		} else if (arg == "--rects") {
+			find_rects = true;
+		} else if (arg == "--reuse-mask") {
+			reuse_mask = true;
+		} else if (arg == "--dedupe") {
+			dedupe = true;
+		} else if (arg == "--y4m") {
+			y4m = true;
+		} else if (arg == "--in-place") {
+			in_place = true;
+		} else if (arg == "--sequence" && i + 1 < argc) {
+			sequence_dir = argv[++i];
+		} else if (arg == "--batch" && i + 2 < argc) {
+			batch_in_dir  = argv[++i];
+			batch_out_dir = argv[++i];
+		} else if (arg == "--trace" && i + 1 < argc) {
+			trace_file = argv[++i];
+		} else if (arg == "--stream" && i + 1 < argc) {
+			const auto size = argv[++i];
+
+			const auto num_parsed = sscanf(size,
+			                               "%dx%d",
+			                               &stream_width,
+			                               &stream_height);
+
+			if (num_parsed != 2 || stream_width <= 0 ||
+			    stream_height <= 0 ||
+			    stream_width % FrameWidthMultiple != 0) {
+				fprintf(stderr,
+				        "Invalid stream frame size '%s' (the width must "
+				        "be a multiple of 64)\n",
+				        size);
+				exit(EXIT_FAILURE);
+			}
+		} else if (arg == "--strength" && i + 1 < argc) {
+			if (!parse_strength(argv[++i], strength)) {
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+		} else if (arg.starts_with("--")) {
+			print_usage();
+			exit(EXIT_FAILURE);
+		} else {
+			input_files.emplace_back(argv[i]);
 		}
-		// total 5.60 us
+	}
+	const auto stream   = (stream_width > 0);
+	const auto sequence = (sequence_dir != nullptr);
+	const auto batch    = (batch_in_dir != nullptr);
+
+	// Every input is a frame of the sequence; otherwise there can only be
+	// one input image
+	const auto input_file = (!sequence && input_files.size() == 1)
+	                              ? input_files.front().c_str()
+	                              : nullptr;
+
+	const auto num_sources = (input_file ? 1 : 0) + (stream ? 1 : 0) +
+	                         (y4m ? 1 : 0) + (sequence ? 1 : 0) +
+	                         (batch ? 1 : 0);
+
+	if (num_sources != 1 || (!input_file && !sequence && !input_files.empty()) ||
+	    (sequence && input_files.empty()) ||
+	    (find_rects && (!input_file || num_threads != 1)) ||
+	    (input_file && reuse_mask) || ((input_file || sequence) && dedupe)) {
+		print_usage();
+		exit(EXIT_FAILURE);
+	}
 
-		write_buffer("out/erode.png", buffer2);
-#endif
-#if 1
-		for (auto i = 0; i < 2; ++i) {
-			// 1.92 us
-			dilate_horiz(buffer2, buffer3);
+	if (trace_file) {
+		enable_tracing();
+		set_trace_thread_name("main");
+	}
 
-			// 1.45 us
-			dilate_vert(buffer3, buffer2);
+	auto run = [&] {
+		if (batch) {
+			return run_batch(batch_in_dir,
+			                 batch_out_dir,
+			                 strength,
+			                 num_threads,
+			                 reuse_mask,
+			                 dedupe);
 		}
-		// total 5.60 us
 
-		write_buffer("out/dilate.png", buffer2);
+		if (sequence) {
+			return run_sequence(input_files,
+			                    sequence_dir,
+			                    strength,
+			                    num_threads,
+			                    reuse_mask);
+		}
 
-		// buffer 2 now contains the mask for the interlaced FMV area
-#endif
-#if 1
-		// 95 us
-		deinterlace(input_image, buffer2, output_image);
-#endif
+		if (y4m) {
+			return run_y4m_stream(strength, num_threads, reuse_mask, dedupe);
+		}
 
-		auto end = std::chrono::high_resolution_clock::now();
-		uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		if (stream) {
+			Deinterlacer deinterlacer(stream_width, stream_height);
 
-		durations_ns.emplace_back(nanoseconds);
+			deinterlacer.set_strength(strength);
+			deinterlacer.set_num_threads(num_threads);
+			deinterlacer.set_reuse_mask(reuse_mask);
 
-#if 1
-		constexpr auto WriteComp = 4;
+			return run_stream(deinterlacer,
+			                  stream_width,
+			                  stream_height,
+			                  in_place,
+			                  dedupe);
+		}
 
-		stbi_write_png("out/output.png",
-		               image_width,
-		               image_height,
-		               WriteComp,
-		               output_image.data(),
-		               image_width * WriteComp);
-#endif
-	}
+		return run_image(input_file, strength, num_threads, find_rects, in_place);
+	};
 
-	// Benchmark results
-	// =================
-	// 10k iterations, averaged
-	// 640x480 input image
-	//
-	//
-	// 2024 MacMini, Apple M4
-	// ----------------------
-	//   uint8_t masks
-	//       first implementation  1117 us
-	//       threshold_8           1084 us
-	//       downshift_and_xor_8   1058 us
-	//       erode_vert_8           806 us
-	//       dilate_vert_8          605 us
-	//
-	//  bitfield masks
-	//       total                  155 us
-	//
-	//
-	// AMD Ryzen 7900
-	// --------------
-	//   uint8_t masks
-	//       first implementation  1454 us
-	//
-	//       threshold_8
-	//       downshift_and_xor_8
-	//       erode_vert_8
-	//       dilate_vert_8          753 us
-	//
-	//  bitfield masks
-	//       erode_horiz              5 us
-	//       erode_vert             1.6 us
-	//       dilate_horiz             5 us
-	//       dilate_vert            1.6 us
-	//       deinterlace             97 us
-	//
-	//       total                  220 us
-	//
-	//  kklobe changes
-	//       total                   24 us
-
-	double average_ns = 0;
-	for (const auto t : durations_ns) {
-		average_ns += (double)t;
-	}
-	average_ns /= (double)durations_ns.size();
+	const auto result = run();
 
-	printf("Total time: %.2f microseconds\n", average_ns / 1000.0);
+	if (trace_file && !write_trace(trace_file)) {
+		fprintf(stderr, "Error writing trace file '%s'\n", trace_file);
+		return EXIT_FAILURE;
+	}
+	return result;
 }
-
@@ -0,0 +1,397 @@
+#include "deinterlacer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+#include "trace.h"
+
+// Every stage works on whole 64-pixel mask words, so other widths would get
+// their right edge silently dropped from the mask
+static void check_frame_size(const int width, const int height)
+{
+	if (width < 0 || height < 0 || width % FrameWidthMultiple != 0) {
+		throw std::invalid_argument(
+		        "Unsupported frame size " + std::to_string(width) + "x" +
+		        std::to_string(height) + " (the width must be a multiple of " +
+		        std::to_string(FrameWidthMultiple) + ")");
+	}
+}
+
+Deinterlacer::Deinterlacer(const int width, const int height)
+{
+	check_frame_size(width, height);
+
+	mask_layout = make_mask_layout(width, height);
+
+	set_num_threads(1);
+}
+
+Deinterlacer::~Deinterlacer()
+{
+	stop_workers();
+}
+
+void Deinterlacer::set_strength(const Strength _strength)
+{
+	strength = _strength;
+}
+
+void Deinterlacer::set_find_rects(const bool _find_rects)
+{
+	find_rects = _find_rects;
+}
+
+void Deinterlacer::set_reuse_mask(const bool _reuse_mask)
+{
+	reuse_mask = _reuse_mask;
+	temporal_mask.invalidate();
+}
+
+void Deinterlacer::set_num_threads(int num_threads)
+{
+	if (num_threads <= 0) {
+		num_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+	}
+	if ((int)bands.size() == num_threads) {
+		return;
+	}
+
+	stop_workers();
+
+	bands.resize(num_threads);
+	resize(mask_layout.width, mask_layout.height);
+
+	in_place_barrier = std::make_unique<std::barrier<>>(num_threads);
+
+	quit = false;
+	for (auto band = 1; band < num_threads; ++band) {
+		workers.emplace_back(&Deinterlacer::worker_loop,
+		                     this,
+		                     band,
+		                     job_generation);
+	}
+}
+
+void Deinterlacer::stop_workers()
+{
+	{
+		std::lock_guard lock(mutex);
+		quit = true;
+	}
+	start_cv.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+}
+
+void Deinterlacer::resize(const int width, const int height)
+{
+	mask_layout = make_mask_layout(width, height);
+
+	const auto num_bands = (int)bands.size();
+	const auto band_rows = (height + num_bands - 1) / num_bands;
+
+	// The halos are clipped at the edges of the frame
+	const auto max_mask_rows = std::min(band_rows + BandHaloTop +
+	                                            BandHaloBottom,
+	                                    height);
+
+	const auto num_words = (size_t)width / 64;
+
+	for (auto& band : bands) {
+		grow_buffer(band.mask, mask_buffer_size(mask_layout, max_mask_rows));
+		grow_buffer(band.occupancy, (max_mask_rows + 63) / 64);
+		grow_buffer(band.prev_line, num_words);
+		grow_buffer(band.open_lines, OpenMaskNumLines * num_words);
+		grow_buffer(band.row_above, (size_t)width);
+	}
+}
+
+void Deinterlacer::process(const FrameView& src, const FrameView& dest)
+{
+	assert(src.width == dest.width && src.height == dest.height);
+
+	job_src      = src;
+	job_dest     = dest;
+	job_in_place = false;
+	job_is_yuv   = false;
+
+	run(src.width, src.height);
+}
+
+void Deinterlacer::process_in_place(const FrameView& frame)
+{
+	job_src      = frame;
+	job_dest     = frame;
+	job_in_place = true;
+	job_is_yuv   = false;
+
+	run(frame.width, frame.height);
+}
+
+void Deinterlacer::process_in_place(const YuvFrameView& frame)
+{
+	job_yuv      = frame;
+	job_in_place = true;
+	job_is_yuv   = true;
+
+	run(frame.y.width, frame.y.height);
+}
+
+void Deinterlacer::run(const int width, const int height)
+{
+	if (width != mask_layout.width || height != mask_layout.height) {
+		check_frame_size(width, height);
+		resize(width, height);
+	}
+
+	const auto num_bands = (int)bands.size();
+
+	job_band_rows = (height + num_bands - 1) / num_bands;
+
+	if (reuse_mask) {
+		update_temporal_mask();
+	}
+	if (!finds_rects()) {
+		found_rects.clear();
+	} else if (reuse_mask) {
+		find_mask_rects(mask_layout,
+		                temporal_mask.mask(),
+		                temporal_mask.occupancy(),
+		                height,
+		                rect_scratch,
+		                found_rects);
+	}
+
+	if (num_bands == 1) {
+		process_band(0);
+		return;
+	}
+
+	{
+		std::lock_guard lock(mutex);
+		num_pending = num_bands - 1;
+		++job_generation;
+	}
+	start_cv.notify_all();
+
+	process_band(0);
+
+	const TraceSpan span("wait_for_bands");
+
+	std::unique_lock lock(mutex);
+	done_cv.wait(lock, [&] { return num_pending == 0; });
+}
+
+bool Deinterlacer::finds_rects() const
+{
+	return find_rects && (reuse_mask || bands.size() == 1);
+}
+
+void Deinterlacer::update_temporal_mask()
+{
+	const TraceSpan span("update_temporal_mask");
+
+	if (job_is_yuv) {
+		temporal_mask.update(mask_layout, job_yuv.y, job_yuv.black_level);
+	} else {
+		temporal_mask.update(mask_layout, job_src);
+	}
+}
+
+void Deinterlacer::worker_loop(const int band, uint64_t last_generation)
+{
+	set_trace_thread_name("band " + std::to_string(band));
+
+	for (;;) {
+		{
+			std::unique_lock lock(mutex);
+			start_cv.wait(lock, [&] {
+				return quit || job_generation != last_generation;
+			});
+			if (quit) {
+				return;
+			}
+			last_generation = job_generation;
+		}
+
+		process_band(band);
+
+		bool all_done = false;
+		{
+			std::lock_guard lock(mutex);
+			all_done = (--num_pending == 0);
+		}
+		if (all_done) {
+			done_cv.notify_one();
+		}
+	}
+}
+
+// Runs the whole pipeline for the rows of a band. Bands only share the
+// (read-only) source frame, and they write disjoint rows of the destination
+// frame, so they can run in parallel without synchronisation.
+//
+// When deinterlacing in place, the mask halos of a band read its neighbours'
+// rows, so all bands must finish building their masks before any of them
+// starts modifying the frame. The row above the band is saved before that
+// point.
+void Deinterlacer::process_band(const int band)
+{
+	auto& buffers = bands[band];
+
+	const auto height    = mask_layout.height;
+	const auto first_row = std::min(band * job_band_rows, height);
+	const auto last_row  = std::min(first_row + job_band_rows, height);
+
+	// The whole frame's mask is already up to date when it's reused
+	auto& mask      = reuse_mask ? temporal_mask.mask() : buffers.mask;
+	auto& occupancy = reuse_mask ? temporal_mask.occupancy()
+	                             : buffers.occupancy;
+
+	const auto mask_first_row = reuse_mask
+	                                  ? 0
+	                                  : std::max(first_row - BandHaloTop, 0);
+	if (!reuse_mask) {
+		build_band_mask(buffers, mask_first_row, last_row);
+
+		// A single band's mask covers the whole frame
+		if (finds_rects()) {
+			find_mask_rects(mask_layout,
+			                mask,
+			                occupancy,
+			                height,
+			                rect_scratch,
+			                found_rects);
+		}
+	}
+
+	if (!job_in_place) {
+		deinterlace_rows(mask_layout,
+		                 job_src,
+		                 mask,
+		                 occupancy,
+		                 job_dest,
+		                 first_row,
+		                 last_row,
+		                 mask_first_row,
+		                 strength);
+		return;
+	}
+
+	if (job_is_yuv) {
+		process_yuv_band_in_place(buffers,
+		                          mask,
+		                          occupancy,
+		                          first_row,
+		                          last_row,
+		                          mask_first_row);
+		return;
+	}
+
+	if (first_row > 0) {
+		std::copy_n(job_dest.pixels + (first_row - 1) * job_dest.pitch,
+		            mask_layout.width,
+		            buffers.row_above.begin());
+	}
+	if (bands.size() > 1) {
+		const TraceSpan span("wait_for_bands");
+		in_place_barrier->arrive_and_wait();
+	}
+
+	deinterlace_rows_in_place(mask_layout,
+	                          job_dest,
+	                          mask,
+	                          occupancy,
+	                          first_row,
+	                          last_row,
+	                          mask_first_row,
+	                          buffers.row_above.data(),
+	                          strength);
+}
+
+// Builds the final mask of a band, including its halo rows
+void Deinterlacer::build_band_mask(BandBuffers& buffers,
+                                   const int mask_first_row,
+                                   const int last_row)
+{
+	const auto mask_last_row = std::min(last_row + BandHaloBottom,
+	                                    mask_layout.height);
+	const auto num_mask_rows = mask_last_row - mask_first_row;
+
+	if (job_is_yuv) {
+		threshold_luma_and_xor(mask_layout,
+		                       job_yuv.y,
+		                       job_yuv.black_level,
+		                       buffers.mask,
+		                       buffers.occupancy,
+		                       buffers.prev_line,
+		                       mask_first_row,
+		                       num_mask_rows);
+	} else {
+		threshold_and_xor(mask_layout,
+		                  job_src,
+		                  buffers.mask,
+		                  buffers.occupancy,
+		                  buffers.prev_line,
+		                  mask_first_row,
+		                  num_mask_rows);
+	}
+
+	open_mask(mask_layout,
+	          buffers.mask,
+	          buffers.occupancy,
+	          buffers.mask,
+	          buffers.occupancy,
+	          buffers.open_lines,
+	          num_mask_rows);
+}
+
+// Blend step of process_band() for YUV frames. The Y, U and V rows above the
+// band are saved next to each other in the row_above buffer (which has room
+// for four bytes per pixel). 4:2:0 chroma doesn't bleed from the row above,
+// so only the Y row is needed then.
+void Deinterlacer::process_yuv_band_in_place(BandBuffers& buffers,
+                                             MaskBuffer& mask,
+                                             RowOccupancy& occupancy,
+                                             const int first_row,
+                                             const int last_row,
+                                             const int mask_first_row)
+{
+	const auto rows_above = reinterpret_cast<uint8_t*>(
+	        buffers.row_above.data());
+
+	if (first_row > 0) {
+		const auto width = mask_layout.width;
+
+		auto save_row_above = [&](const PlaneView& plane, const int index) {
+			std::copy_n(plane.pixels + (first_row - 1) * plane.pitch,
+			            width,
+			            rows_above + index * width);
+		};
+
+		save_row_above(job_yuv.y, 0);
+		if (job_yuv.subsampling == ChromaSubsampling::Yuv444) {
+			save_row_above(job_yuv.u, 1);
+			save_row_above(job_yuv.v, 2);
+		}
+	}
+	if (bands.size() > 1) {
+		const TraceSpan span("wait_for_bands");
+		in_place_barrier->arrive_and_wait();
+	}
+
+	deinterlace_yuv_rows_in_place(mask_layout,
+	                              job_yuv,
+	                              mask,
+	                              occupancy,
+	                              first_row,
+	                              last_row,
+	                              mask_first_row,
+	                              rows_above,
+	                              strength);
+}
@@ -0,0 +1,143 @@
+#ifndef FMV_DEINTERLACE_DEINTERLACER_H
+#define FMV_DEINTERLACE_DEINTERLACER_H
+
+#include <barrier>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stages.h"
+#include "temporal_mask.h"
+
+// Reusable deinterlacing context. It owns all working buffers (64-byte
+// aligned mask buffers, line buffers, rect finding scratch) and the band
+// worker threads, and reuses them for every frame, so processing a stream of
+// frames of the same size does no heap allocations after the first frame.
+// The buffers are only reallocated when a frame needs more room than any of
+// the frames before it.
+//
+// Instances share no state, so several of them can be used in parallel from
+// different threads; a single instance must not be used from more than one
+// thread at a time.
+//
+// Frame widths must be a multiple of FrameWidthMultiple (64). The
+// constructor and the process functions throw std::invalid_argument for
+// any other width or a negative size.
+class Deinterlacer {
+public:
+	Deinterlacer(const int width, const int height);
+	~Deinterlacer();
+
+	Deinterlacer(const Deinterlacer&)            = delete;
+	Deinterlacer& operator=(const Deinterlacer&) = delete;
+
+	void set_strength(const Strength strength);
+
+	// Process frames in N horizontal bands in parallel (0 = one per CPU
+	// core). Bands 1 to N - 1 run on persistent worker threads, band 0 on
+	// the calling thread.
+	void set_num_threads(const int num_threads);
+
+	// Find the bounding rectangles of the detected FMV regions of every
+	// frame (see rects()). Only done with a single thread or when reusing
+	// the mask, as the band masks don't cover the whole frame.
+	void set_find_rects(const bool find_rects);
+
+	// Keep the mask of the previous frame and only recompute it around
+	// the tiles that changed (see TemporalMask). Meant for streams of
+	// frames; the mask stages then run on the calling thread, and only the
+	// blend is split into bands.
+	void set_reuse_mask(const bool reuse_mask);
+
+	// Deinterlaces `src` into `dest`; both must be the same size. The size
+	// of the frames can change between calls.
+	void process(const FrameView& src, const FrameView& dest);
+
+	// Deinterlaces `frame` in place
+	void process_in_place(const FrameView& frame);
+
+	// Deinterlaces a planar YUV frame in place. The mask is built from the
+	// luma plane alone.
+	void process_in_place(const YuvFrameView& frame);
+
+	const MaskLayout& layout() const
+	{
+		return mask_layout;
+	}
+
+	// FMV regions found in the last frame in find rects mode
+	const std::vector<Rect>& rects() const
+	{
+		return found_rects;
+	}
+
+	// Number of mask tiles recomputed for the last frame in reuse mask
+	// mode
+	int num_changed_tiles() const
+	{
+		return temporal_mask.num_changed_tiles();
+	}
+
+private:
+	// Per-band working buffers
+	struct BandBuffers {
+		MaskBuffer mask         = {};
+		RowOccupancy occupancy  = {};
+		MaskBuffer prev_line    = {};
+		MaskBuffer open_lines   = {};
+
+		// Copy of the row above the band for in-place processing
+		std::vector<uint32_t> row_above = {};
+	};
+
+	void resize(const int width, const int height);
+	void run(const int width, const int height);
+	bool finds_rects() const;
+	void update_temporal_mask();
+	void process_band(const int band);
+	void build_band_mask(BandBuffers& buffers, const int mask_first_row,
+	                     const int last_row);
+	void process_yuv_band_in_place(BandBuffers& buffers, MaskBuffer& mask,
+	                               RowOccupancy& occupancy,
+	                               const int first_row, const int last_row,
+	                               const int mask_first_row);
+	void worker_loop(const int band, uint64_t last_generation);
+	void stop_workers();
+
+	MaskLayout mask_layout = {};
+
+	Strength strength = Strength::Subtle;
+	bool find_rects   = false;
+	bool reuse_mask   = false;
+
+	std::vector<BandBuffers> bands = {};
+
+	TemporalMask temporal_mask = {};
+
+	RectScratch rect_scratch      = {};
+	std::vector<Rect> found_rects = {};
+
+	// Current job, set before waking up the workers
+	FrameView job_src      = {};
+	FrameView job_dest     = {};
+	YuvFrameView job_yuv   = {};
+	bool job_in_place      = false;
+	bool job_is_yuv        = false;
+	int job_band_rows      = 0;
+
+	std::unique_ptr<std::barrier<>> in_place_barrier = {};
+
+	std::vector<std::thread> workers = {};
+
+	std::mutex mutex                  = {};
+	std::condition_variable start_cv  = {};
+	std::condition_variable done_cv   = {};
+	uint64_t job_generation           = 0;
+	int num_pending                   = 0;
+	bool quit                         = false;
+};
+
+#endif // FMV_DEINTERLACE_DEINTERLACER_H
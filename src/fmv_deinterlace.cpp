@@ -0,0 +1,116 @@
+#include "fmv_deinterlace.h"
+
+#include <new>
+
+#include "deinterlacer.h"
+
+struct fmv_deinterlacer {
+	fmv_deinterlacer(const int width, const int height, const int pitch)
+	        : deinterlacer(width, height),
+	          width(width),
+	          height(height),
+	          pitch(pitch)
+	{}
+
+	Deinterlacer deinterlacer;
+
+	int width  = 0;
+	int height = 0;
+
+	// In pixels
+	int pitch = 0;
+};
+
+static FrameView frame_view(const fmv_deinterlacer* d, const uint32_t* pixels)
+{
+	// The FrameView is only read through when it's the source
+	return {const_cast<uint32_t*>(pixels), d->width, d->height, d->pitch};
+}
+
+fmv_deinterlacer* fmv_deinterlacer_create(const int width, const int height,
+                                          const int pitch)
+{
+	if (width <= 0 || height <= 0 || width % FrameWidthMultiple != 0 ||
+	    pitch % 4 != 0 || pitch / 4 < width) {
+		return nullptr;
+	}
+	try {
+		return new fmv_deinterlacer(width, height, pitch / 4);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void fmv_deinterlacer_destroy(fmv_deinterlacer* d)
+{
+	delete d;
+}
+
+fmv_result fmv_deinterlacer_set_strength(fmv_deinterlacer* d,
+                                         const fmv_strength strength)
+{
+	if (!d || strength < FMV_STRENGTH_LOW || strength > FMV_STRENGTH_FULL) {
+		return FMV_ERROR_INVALID_ARGUMENT;
+	}
+	d->deinterlacer.set_strength(static_cast<Strength>(strength));
+	return FMV_OK;
+}
+
+fmv_result fmv_deinterlacer_set_num_threads(fmv_deinterlacer* d,
+                                            const int num_threads)
+{
+	if (!d || num_threads < 0) {
+		return FMV_ERROR_INVALID_ARGUMENT;
+	}
+	try {
+		d->deinterlacer.set_num_threads(num_threads);
+	} catch (const std::bad_alloc&) {
+		return FMV_ERROR_OUT_OF_MEMORY;
+	} catch (...) {
+		return FMV_ERROR_INTERNAL;
+	}
+	return FMV_OK;
+}
+
+fmv_result fmv_deinterlacer_set_reuse_mask(fmv_deinterlacer* d,
+                                           const int enable)
+{
+	if (!d) {
+		return FMV_ERROR_INVALID_ARGUMENT;
+	}
+	d->deinterlacer.set_reuse_mask(enable != 0);
+	return FMV_OK;
+}
+
+fmv_result fmv_deinterlacer_process_in_place(fmv_deinterlacer* d,
+                                             uint32_t* frame)
+{
+	if (!d || !frame) {
+		return FMV_ERROR_INVALID_ARGUMENT;
+	}
+	// Exceptions must not cross the C boundary
+	try {
+		d->deinterlacer.process_in_place(frame_view(d, frame));
+	} catch (const std::bad_alloc&) {
+		return FMV_ERROR_OUT_OF_MEMORY;
+	} catch (...) {
+		return FMV_ERROR_INTERNAL;
+	}
+	return FMV_OK;
+}
+
+fmv_result fmv_deinterlacer_process(fmv_deinterlacer* d,
+                                    const uint32_t* src, uint32_t* dest)
+{
+	if (!d || !src || !dest || src == dest) {
+		return FMV_ERROR_INVALID_ARGUMENT;
+	}
+	try {
+		d->deinterlacer.process(frame_view(d, src), frame_view(d, dest));
+	} catch (const std::bad_alloc&) {
+		return FMV_ERROR_OUT_OF_MEMORY;
+	} catch (...) {
+		return FMV_ERROR_INTERNAL;
+	}
+	return FMV_OK;
+}
@@ -0,0 +1,103 @@
+#ifndef FMV_DEINTERLACE_H
+#define FMV_DEINTERLACE_H
+
+// C interface of libfmvdeinterlace
+//
+// Typical use from an emulator frontend:
+//
+//   fmv_deinterlacer* d = fmv_deinterlacer_create(width, height, pitch);
+//
+//   // once per frame
+//   fmv_deinterlacer_process_in_place(d, framebuffer);
+//
+//   fmv_deinterlacer_destroy(d);
+//
+// Frames are 32-bit RGBA (or any other 4 byte per pixel format with the
+// alpha or unused byte last in memory). A context allocates all its buffers
+// when it's created; processing frames does no heap allocations, file I/O or
+// any other system calls apart from waking up its worker threads.
+//
+// A context must not be used from more than one thread at a time, but any
+// number of contexts can be used in parallel.
+
+#include <stdint.h>
+
+#if defined(FMV_DEINTERLACE_STATIC)
+#define FMV_API
+#elif defined(_WIN32)
+#ifdef FMV_DEINTERLACE_BUILD
+#define FMV_API __declspec(dllexport)
+#else
+#define FMV_API __declspec(dllimport)
+#endif
+#else
+#define FMV_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fmv_deinterlacer fmv_deinterlacer;
+
+typedef enum {
+	FMV_OK                     = 0,
+	FMV_ERROR_INVALID_ARGUMENT = -1,
+	FMV_ERROR_OUT_OF_MEMORY    = -2,
+
+	// Any other failure, e.g. a worker thread that couldn't be started
+	FMV_ERROR_INTERNAL = -3,
+} fmv_result;
+
+// Deinterlacing strength (the fraction of the row above that's bled into
+// the missing rows)
+typedef enum {
+	FMV_STRENGTH_LOW    = 0, // 1/2
+	FMV_STRENGTH_MEDIUM = 1, // 2/3
+	FMV_STRENGTH_HIGH   = 2, // 4/5
+	FMV_STRENGTH_SUBTLE = 3, // 8/9 (default)
+	FMV_STRENGTH_FULL   = 4, // 1/1
+} fmv_strength;
+
+// Creates a context for frames of the given size. `pitch` is the number of
+// bytes between two consecutive rows; it must be a multiple of 4 and at
+// least width * 4. The width must be a multiple of 64. Returns NULL if the
+// size is invalid or the buffers can't be allocated.
+FMV_API fmv_deinterlacer* fmv_deinterlacer_create(int width, int height,
+                                                  int pitch);
+
+FMV_API void fmv_deinterlacer_destroy(fmv_deinterlacer* d);
+
+FMV_API fmv_result fmv_deinterlacer_set_strength(fmv_deinterlacer* d,
+                                                 fmv_strength strength);
+
+// Process frames in N horizontal bands in parallel (0 = one per CPU core,
+// default is 1). Starts or stops worker threads, so call it outside of the
+// per-frame path.
+FMV_API fmv_result fmv_deinterlacer_set_num_threads(fmv_deinterlacer* d,
+                                                    int num_threads);
+
+// Keep the mask of the previous frame and only recompute it in the areas
+// that changed (0 = off, default). Worth enabling when the frames form a
+// continuous stream, e.g. every frame of the emulated machine. The extra
+// buffers are allocated by the first frame processed after enabling it.
+FMV_API fmv_result fmv_deinterlacer_set_reuse_mask(fmv_deinterlacer* d,
+                                                   int enable);
+
+// Deinterlaces `frame` in place. Returns FMV_ERROR_OUT_OF_MEMORY if the
+// buffers of the mask reuse can't be allocated; the frame is left unchanged
+// or partly processed in that case.
+FMV_API fmv_result fmv_deinterlacer_process_in_place(fmv_deinterlacer* d,
+                                                     uint32_t* frame);
+
+// Deinterlaces `src` into `dest`; both use the pitch of the context and must
+// not overlap
+FMV_API fmv_result fmv_deinterlacer_process(fmv_deinterlacer* d,
+                                            const uint32_t* src,
+                                            uint32_t* dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FMV_DEINTERLACE_H
@@ -0,0 +1,98 @@
+#include "frame_cache.h"
+
+#include <bit>
+#include <cstring>
+
+constexpr uint64_t Prime1 = 0x9e3779b185ebca87;
+constexpr uint64_t Prime2 = 0xc2b2ae3d27d4eb4f;
+constexpr uint64_t Prime3 = 0x165667b19e3779f9;
+
+static uint64_t load_u64(const uint8_t* p)
+{
+	uint64_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t hash_round(uint64_t acc, const uint64_t word)
+{
+	acc += word * Prime2;
+	acc = std::rotl(acc, 31);
+	return acc * Prime1;
+}
+
+uint64_t hash_bytes(const uint8_t* data, const size_t size,
+                    const uint64_t seed)
+{
+	// Four lanes so the multiplies of consecutive words don't depend on
+	// each other
+	uint64_t lanes[4] = {seed + Prime1 + Prime2,
+	                     seed + Prime2,
+	                     seed,
+	                     seed - Prime1};
+
+	const auto end = data + size;
+	auto p         = data;
+
+	for (; p + 32 <= end; p += 32) {
+		lanes[0] = hash_round(lanes[0], load_u64(p));
+		lanes[1] = hash_round(lanes[1], load_u64(p + 8));
+		lanes[2] = hash_round(lanes[2], load_u64(p + 16));
+		lanes[3] = hash_round(lanes[3], load_u64(p + 24));
+	}
+
+	auto hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) +
+	            std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+
+	hash += size;
+
+	for (; p + 8 <= end; p += 8) {
+		hash ^= hash_round(0, load_u64(p));
+		hash = std::rotl(hash, 27) * Prime1 + Prime3;
+	}
+	for (; p < end; ++p) {
+		hash ^= *p * Prime3;
+		hash = std::rotl(hash, 11) * Prime1;
+	}
+
+	// Final avalanche
+	hash ^= hash >> 33;
+	hash *= Prime2;
+	hash ^= hash >> 29;
+	hash *= Prime3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+FrameCache::FrameCache(const size_t _frame_size, const int capacity)
+        : frame_size(_frame_size),
+          entries(capacity),
+          inputs(frame_size * capacity),
+          outputs(frame_size * capacity)
+{}
+
+const uint8_t* FrameCache::find(const uint64_t hash, const uint8_t* input)
+{
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (entries[i].valid && entries[i].hash == hash &&
+		    std::memcmp(inputs.data() + i * frame_size, input, frame_size) ==
+		            0) {
+			++hits;
+			return outputs.data() + i * frame_size;
+		}
+	}
+	return nullptr;
+}
+
+uint8_t* FrameCache::insert(const uint64_t hash, const uint8_t* input)
+{
+	const auto i = (size_t)next_entry;
+
+	entries[i] = {hash, true};
+	std::memcpy(inputs.data() + i * frame_size, input, frame_size);
+
+	next_entry = (next_entry + 1) % (int)entries.size();
+
+	return outputs.data() + i * frame_size;
+}
@@ -0,0 +1,72 @@
+#ifndef FMV_DEINTERLACE_FRAME_CACHE_H
+#define FMV_DEINTERLACE_FRAME_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fast 64-bit hash of a block of memory (the XXH64 round function over four
+// independent lanes). Not cryptographic; only meant for spotting repeated
+// frames. Different seeds give independent hashes of the same data.
+uint64_t hash_bytes(const uint8_t* data, const size_t size,
+                    const uint64_t seed = 0);
+
+// Deinterlaced output of the last few distinct input frames of a stream.
+// FMV is usually captured at several times its own frame rate, so most
+// input frames are exact repeats of a recent one, and their output can be
+// reused instead of running the pipeline again.
+//
+// Frames are looked up by their 64-bit hash, and the input of a matching
+// entry is then compared byte by byte, so a hash collision can't return the
+// output of a different frame. The comparison only runs on a hash match,
+// and costs a fraction of the pipeline it saves. All storage is allocated
+// when the cache is created.
+//
+// Frames are hashed as a whole rather than row by row: a frame with only
+// some rows changed has to go through the pipeline anyway, and skipping
+// the mask work of its unchanged parts is what the mask reuse of
+// TemporalMask (--reuse-mask) already does tile by tile.
+//
+// Only the streaming modes use the cache. The batch mode shares
+// hash_bytes() but keeps its own map of the files already written, as its
+// images can differ in size and repeat from anywhere in the directory.
+class FrameCache {
+public:
+	// Holds up to `capacity` frames of `frame_size` bytes
+	FrameCache(const size_t frame_size, const int capacity);
+
+	// Returns the output stored for the `frame_size` bytes of `input`, or
+	// nullptr if they're not in the cache. `hash` is the hash_bytes() hash
+	// of the input.
+	const uint8_t* find(const uint64_t hash, const uint8_t* input);
+
+	// Adds a copy of an input frame, replacing the oldest entry if the cache
+	// is full, and returns the buffer its output must be written to before
+	// the next lookup
+	uint8_t* insert(const uint64_t hash, const uint8_t* input);
+
+	// Number of successful lookups so far
+	int num_hits() const
+	{
+		return hits;
+	}
+
+private:
+	struct Entry {
+		uint64_t hash = 0;
+		bool valid    = false;
+	};
+
+	size_t frame_size = 0;
+
+	std::vector<Entry> entries = {};
+
+	// Inputs and outputs of the entries, `frame_size` bytes each
+	std::vector<uint8_t> inputs  = {};
+	std::vector<uint8_t> outputs = {};
+
+	int next_entry = 0;
+	int hits       = 0;
+};
+
+#endif // FMV_DEINTERLACE_FRAME_CACHE_H
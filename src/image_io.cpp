@@ -0,0 +1,74 @@
+#include "image_io.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+bool load_image(const char* filename, std::vector<uint32_t>& image,
+                int& width, int& height)
+{
+	int channels_in_file;
+
+	// Ask for RGBA pixels (uint32_t)
+	constexpr int DesiredChannels = 4;
+
+	uint8_t* data = stbi_load(filename,
+	                          &width,
+	                          &height,
+	                          &channels_in_file,
+	                          DesiredChannels);
+	if (!data) {
+		return false;
+	}
+
+	const auto num_pixels = width * height;
+	image.resize(num_pixels);
+	std::memcpy(image.data(), data, num_pixels * DesiredChannels);
+
+	stbi_image_free(data);
+	return true;
+}
+
+bool write_png(const char* filename, const int width, const int height,
+               const int num_components, const void* pixels, const int pitch)
+{
+	return stbi_write_png(filename,
+	                      width,
+	                      height,
+	                      num_components,
+	                      pixels,
+	                      pitch) != 0;
+}
+
+std::filesystem::path output_file_name(const std::filesystem::path& in_file)
+{
+	return in_file.filename().replace_extension(".png");
+}
+
+bool check_output_file_names(const std::vector<std::filesystem::path>& files)
+{
+	std::map<std::filesystem::path, const std::filesystem::path*> outputs = {};
+	auto collisions = false;
+
+	for (const auto& file : files) {
+		const auto out_file = output_file_name(file);
+
+		const auto [it, inserted] = outputs.try_emplace(out_file, &file);
+		if (!inserted) {
+			fprintf(stderr,
+			        "Error: '%s' and '%s' would both be written "
+			        "to '%s'\n",
+			        it->second->string().c_str(),
+			        file.string().c_str(),
+			        it->first.string().c_str());
+			collisions = true;
+		}
+	}
+	return !collisions;
+}
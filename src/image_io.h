@@ -0,0 +1,29 @@
+#ifndef FMV_DEINTERLACE_IMAGE_IO_H
+#define FMV_DEINTERLACE_IMAGE_IO_H
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Image file I/O of the command line tools (stb_image and stb_image_write)
+
+// Loads an image as RGBA pixel data
+bool load_image(const char* filename, std::vector<uint32_t>& image,
+                int& width, int& height);
+
+// Writes 8-bit pixel data with `num_components` bytes per pixel (1 = grey,
+// 4 = RGBA) as a PNG file. The pitch is in bytes.
+bool write_png(const char* filename, const int width, const int height,
+               const int num_components, const void* pixels, const int pitch);
+
+// Name of the PNG file an input image file is written to in an output
+// directory
+std::filesystem::path output_file_name(const std::filesystem::path& in_file);
+
+// Reports every input file on stderr that would be written to the same
+// output file as an earlier one (e.g. a.png and a.jpg, or x/a.png and
+// y/a.png), as one would silently overwrite the other. Returns false if
+// there are any.
+bool check_output_file_names(const std::vector<std::filesystem::path>& files);
+
+#endif // FMV_DEINTERLACE_IMAGE_IO_H
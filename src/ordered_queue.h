@@ -0,0 +1,82 @@
+#ifndef FMV_DEINTERLACE_ORDERED_QUEUE_H
+#define FMV_DEINTERLACE_ORDERED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Bounded queue between two stages of a pipeline that hands out a known
+// number of items in their original order, no matter in which order the
+// producers finish them.
+//
+// Item N can only be pushed once items 0 to N - capacity have been popped,
+// so fast producers block until the consumers catch up (backpressure), and
+// consumers block until the next item in order arrives.
+template <typename T>
+class OrderedQueue {
+public:
+	OrderedQueue(const size_t capacity, const size_t num_items)
+	        : slots(capacity),
+	          num_items(num_items)
+	{}
+
+	OrderedQueue(const OrderedQueue&)            = delete;
+	OrderedQueue& operator=(const OrderedQueue&) = delete;
+
+	// Blocks until there's room for item `index`. Every index from 0 to
+	// num_items - 1 must be pushed exactly once.
+	void push(const size_t index, T item)
+	{
+		std::unique_lock lock(mutex);
+
+		push_cv.wait(lock, [&] { return index < next_pop + slots.size(); });
+
+		slots[index % slots.size()] = std::move(item);
+
+		pop_cv.notify_all();
+	}
+
+	// Blocks until the next item in order is available, and returns it with
+	// its index. Returns an empty optional once all items have been popped.
+	std::optional<std::pair<size_t, T>> pop()
+	{
+		std::unique_lock lock(mutex);
+
+		pop_cv.wait(lock, [&] {
+			return next_pop == num_items ||
+			       slots[next_pop % slots.size()].has_value();
+		});
+
+		if (next_pop == num_items) {
+			return {};
+		}
+		auto& slot = slots[next_pop % slots.size()];
+
+		std::pair<size_t, T> result = {next_pop, std::move(*slot)};
+		slot.reset();
+
+		++next_pop;
+
+		// Wakes up the producer of the next free slot, and the other
+		// consumers if there's nothing more to pop
+		push_cv.notify_all();
+		pop_cv.notify_all();
+
+		return result;
+	}
+
+private:
+	std::vector<std::optional<T>> slots = {};
+
+	size_t num_items = 0;
+	size_t next_pop  = 0;
+
+	std::mutex mutex                 = {};
+	std::condition_variable push_cv  = {};
+	std::condition_variable pop_cv   = {};
+};
+
+#endif // FMV_DEINTERLACE_ORDERED_QUEUE_H
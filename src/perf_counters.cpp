@@ -0,0 +1,208 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct EventConfig {
+	uint32_t type   = 0;
+	uint64_t config = 0;
+};
+
+static constexpr uint64_t hw_cache_config(const uint64_t cache,
+                                          const uint64_t op,
+                                          const uint64_t result)
+{
+	return cache | (op << 8) | (result << 16);
+}
+
+// In the order of PerfCounters::Event
+static constexpr EventConfig EventConfigs[PerfCounters::NumEvents] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE,
+         hw_cache_config(PERF_COUNT_HW_CACHE_L1D,
+                         PERF_COUNT_HW_CACHE_OP_READ,
+                         PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+        {PERF_TYPE_HW_CACHE,
+         hw_cache_config(PERF_COUNT_HW_CACHE_L1D,
+                         PERF_COUNT_HW_CACHE_OP_READ,
+                         PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+constexpr auto EventsPerGroup = PerfCounters::NumEvents / 2;
+
+// Value of an event, and how long it was enabled and actually counting (the
+// two differ when the kernel multiplexes the counters)
+struct EventReading {
+	uint64_t value        = 0;
+	uint64_t time_enabled = 0;
+	uint64_t time_running = 0;
+};
+
+static int open_event(const EventConfig& event, const int group_fd)
+{
+	perf_event_attr attr = {};
+
+	attr.size   = sizeof(attr);
+	attr.type   = event.type;
+	attr.config = event.config;
+
+	attr.disabled       = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	// This thread only, on any CPU
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static bool read_event(const int fd, EventReading& reading)
+{
+	return ::read(fd, &reading, sizeof(reading)) == sizeof(reading);
+}
+
+PerfCounters::PerfCounters()
+{
+	auto last_errno = 0;
+
+	for (auto group = 0; group < NumGroups; ++group) {
+		group_leader[group] = -1;
+
+		for (auto i = 0; i < EventsPerGroup; ++i) {
+			const auto event = group * EventsPerGroup + i;
+
+			fds[event] = open_event(EventConfigs[event], group_leader[group]);
+
+			if (fds[event] < 0) {
+				last_errno = errno;
+				continue;
+			}
+			if (group_leader[group] < 0) {
+				group_leader[group] = fds[event];
+			}
+			++num_open;
+		}
+	}
+
+	if (num_open == 0) {
+		error_message = std::string("perf_event_open failed: ") +
+		                strerror(last_errno);
+	}
+}
+
+PerfCounters::~PerfCounters()
+{
+	for (const auto fd : fds) {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+}
+
+void PerfCounters::reset()
+{
+	for (const auto leader : group_leader) {
+		if (leader >= 0) {
+			ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	// The enabled and running times are not reset, so only the time since
+	// now counts for the scaling
+	for (auto event = 0; event < NumEvents; ++event) {
+		EventReading reading = {};
+
+		if (fds[event] >= 0 && read_event(fds[event], reading)) {
+			base_time_enabled[event] = reading.time_enabled;
+			base_time_running[event] = reading.time_running;
+		}
+	}
+}
+
+void PerfCounters::start()
+{
+	for (const auto leader : group_leader) {
+		if (leader >= 0) {
+			ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+}
+
+void PerfCounters::stop()
+{
+	for (const auto leader : group_leader) {
+		if (leader >= 0) {
+			ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+}
+
+PerfCounters::Counts PerfCounters::read() const
+{
+	Counts counts = {};
+
+	for (auto event = 0; event < NumEvents; ++event) {
+		EventReading reading = {};
+
+		if (fds[event] < 0 || !read_event(fds[event], reading)) {
+			counts.values[event] = -1;
+			continue;
+		}
+
+		const auto enabled = reading.time_enabled - base_time_enabled[event];
+		const auto running = reading.time_running - base_time_running[event];
+
+		// Never scheduled: nothing to scale
+		if (running == 0) {
+			counts.values[event] = (enabled == 0) ? 0 : -1;
+			continue;
+		}
+		counts.values[event] = (double)reading.value * (double)enabled /
+		                       (double)running;
+	}
+	return counts;
+}
+
+#else // __linux__
+
+PerfCounters::PerfCounters()
+{
+	for (auto& fd : fds) {
+		fd = -1;
+	}
+	for (auto& leader : group_leader) {
+		leader = -1;
+	}
+	error_message = "performance counters are only supported on Linux";
+}
+
+PerfCounters::~PerfCounters() {}
+
+void PerfCounters::reset() {}
+void PerfCounters::start() {}
+void PerfCounters::stop() {}
+
+PerfCounters::Counts PerfCounters::read() const
+{
+	Counts counts = {};
+
+	for (auto& value : counts.values) {
+		value = -1;
+	}
+	return counts;
+}
+
+#endif // __linux__
@@ -0,0 +1,83 @@
+#ifndef FMV_DEINTERLACE_PERF_COUNTERS_H
+#define FMV_DEINTERLACE_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+// Hardware performance counters of the calling thread (Linux
+// perf_event_open). Only user space events are counted.
+//
+// Counters that the CPU, the kernel or the container doesn't allow are left
+// out, and on other platforms or when none of them can be opened the object
+// is simply unavailable; callers are expected to carry on without the
+// numbers.
+class PerfCounters {
+public:
+	enum Event {
+		Cycles,
+		Instructions,
+		Branches,
+		BranchMisses,
+		L1dReads,
+		L1dReadMisses,
+		LlcReferences,
+		LlcMisses,
+
+		NumEvents
+	};
+
+	// Counts of every event, scaled up if the kernel had to multiplex the
+	// counters. Events that couldn't be opened are -1.
+	struct Counts {
+		double values[NumEvents] = {};
+
+		bool has(const Event event) const
+		{
+			return values[event] >= 0;
+		}
+	};
+
+	PerfCounters();
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&)            = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool is_available() const
+	{
+		return num_open > 0;
+	}
+
+	// Why no counters could be opened
+	const std::string& error() const
+	{
+		return error_message;
+	}
+
+	// Zeroes all counters
+	void reset();
+
+	// Counting only happens between start() and stop(), so they can be
+	// called around the interesting parts of a loop
+	void start();
+	void stop();
+
+	Counts read() const;
+
+private:
+	// Events are opened in two groups of four, so each group fits in the
+	// counters of most CPUs and its events are always counted together
+	static constexpr auto NumGroups = 2;
+
+	int fds[NumEvents]          = {};
+	int group_leader[NumGroups] = {};
+	int num_open                = 0;
+
+	// Enabled and running times of the events at the last reset()
+	uint64_t base_time_enabled[NumEvents] = {};
+	uint64_t base_time_running[NumEvents] = {};
+
+	std::string error_message = {};
+};
+
+#endif // FMV_DEINTERLACE_PERF_COUNTERS_H
@@ -0,0 +1,180 @@
+#include "sequence.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include "deinterlacer.h"
+#include "image_io.h"
+#include "ordered_queue.h"
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+// Frames in flight per consumer thread of a queue
+constexpr auto QueueDepthPerThread = 2;
+
+struct SequenceFrame {
+	std::vector<uint32_t> pixels = {};
+
+	int width  = 0;
+	int height = 0;
+
+	// False if the file couldn't be loaded; the frame is then passed down
+	// the pipeline without pixels so the ordering stays intact
+	bool loaded = false;
+};
+
+int run_sequence(const std::vector<std::string>& input_files,
+                 const std::string& out_dir, const Strength strength,
+                 const int num_threads, const bool reuse_mask)
+{
+	// The encoder threads would overwrite each other's files otherwise
+	if (!check_output_file_names({input_files.begin(), input_files.end()})) {
+		return EXIT_FAILURE;
+	}
+
+	std::error_code error;
+	fs::create_directories(out_dir, error);
+
+	if (error) {
+		fprintf(stderr,
+		        "Error creating output directory '%s': %s\n",
+		        out_dir.c_str(),
+		        error.message().c_str());
+		return EXIT_FAILURE;
+	}
+
+	// PNG encoding is 10-100x slower than decoding, so it gets most of the
+	// threads. The deinterlacing stage has its own band threads.
+	const auto num_cores = std::max((int)std::thread::hardware_concurrency(),
+	                                1);
+	const auto num_decoders = std::max(num_cores / 4, 1);
+	const auto num_encoders = std::max(num_cores - num_decoders, 1);
+
+	const auto num_frames = input_files.size();
+
+	OrderedQueue<SequenceFrame> decoded(num_decoders * QueueDepthPerThread,
+	                                    num_frames);
+
+	OrderedQueue<SequenceFrame> deinterlaced(num_encoders * QueueDepthPerThread,
+	                                         num_frames);
+
+	std::atomic<size_t> next_input = 0;
+	std::atomic<int> num_failed    = 0;
+
+	auto decode = [&](const int decoder) {
+		set_trace_thread_name("decoder " + std::to_string(decoder));
+
+		for (;;) {
+			const auto index = next_input++;
+			if (index >= num_frames) {
+				return;
+			}
+			const auto& filename = input_files[index];
+
+			SequenceFrame frame = {};
+			{
+				const TraceSpan span("decode", (int64_t)index);
+
+				frame.loaded = load_image(filename.c_str(),
+				                          frame.pixels,
+				                          frame.width,
+				                          frame.height);
+			}
+			if (!frame.loaded) {
+				fprintf(stderr,
+				        "Error loading image file '%s'\n",
+				        filename.c_str());
+				++num_failed;
+
+			} else if (frame.width % FrameWidthMultiple != 0) {
+				fprintf(stderr,
+				        "Unsupported width %d in '%s' (must be a "
+				        "multiple of 64)\n",
+				        frame.width,
+				        filename.c_str());
+				++num_failed;
+				frame.loaded = false;
+			}
+			decoded.push(index, std::move(frame));
+		}
+	};
+
+	auto deinterlace = [&] {
+		set_trace_thread_name("deinterlacer");
+
+		Deinterlacer deinterlacer(0, 0);
+
+		deinterlacer.set_strength(strength);
+		deinterlacer.set_num_threads(num_threads);
+		deinterlacer.set_reuse_mask(reuse_mask);
+
+		while (auto item = decoded.pop()) {
+			auto& [index, frame] = *item;
+
+			if (frame.loaded) {
+				const TraceSpan span("deinterlace", (int64_t)index);
+
+				const FrameView view = {frame.pixels.data(),
+				                        frame.width,
+				                        frame.height,
+				                        frame.width};
+
+				deinterlacer.process_in_place(view);
+			}
+			deinterlaced.push(index, std::move(frame));
+		}
+	};
+
+	auto encode = [&](const int encoder) {
+		constexpr auto WriteComp = 4;
+
+		set_trace_thread_name("encoder " + std::to_string(encoder));
+
+		while (auto item = deinterlaced.pop()) {
+			const auto& [index, frame] = *item;
+			if (!frame.loaded) {
+				continue;
+			}
+
+			const auto out_file = fs::path(out_dir) /
+			                      output_file_name(input_files[index]);
+
+			const TraceSpan span("encode", (int64_t)index);
+
+			if (!write_png(out_file.string().c_str(),
+			               frame.width,
+			               frame.height,
+			               WriteComp,
+			               frame.pixels.data(),
+			               frame.width * WriteComp)) {
+				fprintf(stderr,
+				        "Error writing image file '%s'\n",
+				        out_file.string().c_str());
+				++num_failed;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (auto i = 0; i < num_decoders; ++i) {
+		threads.emplace_back(decode, i);
+	}
+	threads.emplace_back(deinterlace);
+
+	for (auto i = 0; i < num_encoders; ++i) {
+		threads.emplace_back(encode, i);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	return (num_failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
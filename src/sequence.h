@@ -0,0 +1,26 @@
+#ifndef FMV_DEINTERLACE_SEQUENCE_H
+#define FMV_DEINTERLACE_SEQUENCE_H
+
+#include <string>
+#include <vector>
+
+#include "stages.h"
+
+// Deinterlaces a sequence of image files (e.g. the frames of a capture) in
+// order, and writes them as PNG files with the same names into `out_dir`.
+//
+// Decoding, deinterlacing and encoding run as a pipeline on separate threads
+// connected by bounded queues, so the throughput is set by the slowest stage
+// (PNG encoding by far) instead of the sum of all of them. Decoding and
+// encoding use several threads; the frames go through a single Deinterlacer
+// in their original order, so the mask reuse works across them.
+//
+// Nothing is written if two input files map to the same output file, e.g.
+// a.png and a.jpg, or x/a.png and y/a.png. Files that fail to load or save
+// are reported on stderr without stopping the rest of the sequence. Returns
+// EXIT_FAILURE if there were any.
+int run_sequence(const std::vector<std::string>& input_files,
+                 const std::string& out_dir, const Strength strength,
+                 const int num_threads, const bool reuse_mask);
+
+#endif // FMV_DEINTERLACE_SEQUENCE_H
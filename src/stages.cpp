@@ -0,0 +1,1739 @@
+#include "stages.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FMV_X86
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef FMV_X86
+
+// MSVC lets us use any intrinsic without extra compiler flags; GCC and Clang
+// need the target ISA enabled per function so the rest of the binary still
+// runs on baseline x86-64 CPUs.
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#define TARGET_AVX512
+#define TARGET_AVX512BW
+#else
+#define TARGET_AVX2     __attribute__((target("avx2")))
+#define TARGET_AVX512   __attribute__((target("avx512f")))
+#define TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#endif
+
+struct CpuFeatures {
+	bool avx2     = false;
+	bool avx512f  = false;
+	bool avx512bw = false;
+};
+
+static void cpuid(const uint32_t leaf, const uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex(reinterpret_cast<int*>(regs), leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static CpuFeatures detect_cpu_features()
+{
+	CpuFeatures features = {};
+
+	uint32_t regs[4];
+	cpuid(0, 0, regs);
+	const auto max_leaf = regs[0];
+	if (max_leaf < 7) {
+		return features;
+	}
+
+	// The OS must save the YMM registers on context switches (OSXSAVE set
+	// and XCR0 bits 1-2 enabled), otherwise AVX instructions will fault
+	// even if the CPU supports them.
+	cpuid(1, 0, regs);
+	constexpr auto OsxsaveBit = 1u << 27;
+	if (!(regs[2] & OsxsaveBit)) {
+		return features;
+	}
+	const auto xcr0 = xgetbv0();
+	constexpr auto YmmStateBits = 0b110;
+	const auto os_saves_ymm = (xcr0 & YmmStateBits) == YmmStateBits;
+
+	// AVX-512 additionally needs the opmask and upper ZMM register state
+	// (XCR0 bits 5-7) to be saved by the OS.
+	constexpr auto ZmmStateBits = 0b1110'0110;
+	const auto os_saves_zmm = (xcr0 & ZmmStateBits) == ZmmStateBits;
+
+	cpuid(7, 0, regs);
+	constexpr auto Avx2Bit     = 1u << 5;
+	constexpr auto Avx512fBit  = 1u << 16;
+	constexpr auto Avx512bwBit = 1u << 30;
+	features.avx2     = os_saves_ymm && (regs[1] & Avx2Bit);
+	features.avx512f  = os_saves_zmm && (regs[1] & Avx512fBit);
+	features.avx512bw = features.avx512f && (regs[1] & Avx512bwBit);
+
+	return features;
+}
+
+// Detected once at startup
+static const CpuFeatures host_cpu_features = detect_cpu_features();
+
+// The kernel selectors below use this to pick the fastest implementation
+// available. It's the host CPU's features unless set_kernel_isa() limits
+// them.
+static CpuFeatures cpu_features = host_cpu_features;
+
+#endif // FMV_X86
+
+// Converts 64 * num_words RGBA pixels into num_words mask words
+using ThresholdRowFunc = void (*)(const uint32_t* in, uint64_t* out,
+                                  const int num_words);
+
+static void threshold_row_scalar(const uint32_t* in, uint64_t* out,
+                                 const int num_words)
+{
+	for (auto x = 0; x < num_words; ++x) {
+		uint64_t out_buf = 0;
+
+		// Build the 64-bit mask 8 pixels at a time to reduce
+		// loop overhead.
+		for (auto n = 0; n < 8; ++n) {
+			// Make sure the alpha component is set to zero
+			constexpr auto mask = 0x00ffffff;
+
+			const auto a1 = in[0] & mask;
+			const auto a2 = in[1] & mask;
+			const auto a3 = in[2] & mask;
+			const auto a4 = in[3] & mask;
+			const auto a5 = in[4] & mask;
+			const auto a6 = in[5] & mask;
+			const auto a7 = in[6] & mask;
+			const auto a8 = in[7] & mask;
+
+			in += 8;
+
+			// Non-black pixels are set to 1 in the bit
+			// mask. We convert the pixels by row, top to
+			// down, left to right. When converting the
+			// first 64 pixels of a row, the LSB of the mask
+			// uint64_t is the first pixel, and the MSB is
+			// the 64th pixel.
+
+			const uint8_t bits = ((a1 != 0) << 0) | ((a2 != 0) << 1) |
+			                     ((a3 != 0) << 2) | ((a4 != 0) << 3) |
+			                     ((a5 != 0) << 4) | ((a6 != 0) << 5) |
+			                     ((a7 != 0) << 6) | ((a8 != 0) << 7);
+
+			out_buf |= (uint64_t)bits << (n * 8);
+		}
+		*out = out_buf;
+		++out;
+	}
+}
+
+#ifdef FMV_X86
+
+TARGET_AVX2
+static void threshold_row_avx2(const uint32_t* in, uint64_t* out,
+                               const int num_words)
+{
+	const auto rgb_mask = _mm256_set1_epi32(0x00ffffff);
+	const auto zero     = _mm256_setzero_si256();
+
+	for (auto x = 0; x < num_words; ++x) {
+		uint64_t out_buf = 0;
+
+		// 8 RGBA pixels per iteration; the compare sets a lane to all
+		// ones for black pixels, and movemask collects the sign bit of
+		// each lane into one bit per pixel (LSB = leftmost pixel).
+		for (auto n = 0; n < 8; ++n) {
+			const auto pixels = _mm256_loadu_si256(
+			        reinterpret_cast<const __m256i*>(in));
+			in += 8;
+
+			const auto rgb      = _mm256_and_si256(pixels, rgb_mask);
+			const auto is_black = _mm256_cmpeq_epi32(rgb, zero);
+			const auto black_bits = (uint32_t)_mm256_movemask_ps(
+			        _mm256_castsi256_ps(is_black));
+
+			out_buf |= (uint64_t)(~black_bits & 0xff) << (n * 8);
+		}
+		*out = out_buf;
+		++out;
+	}
+}
+
+TARGET_AVX512
+static void threshold_row_avx512(const uint32_t* in, uint64_t* out,
+                                 const int num_words)
+{
+	const auto rgb_mask = _mm512_set1_epi32(0x00ffffff);
+
+	for (auto x = 0; x < num_words; ++x) {
+		// vptestmd ANDs each pixel with the RGB mask and sets the
+		// predicate bit of every non-zero lane, which is exactly one
+		// mask bit per non-black pixel. Four 16-lane predicates make
+		// up one 64-pixel mask word.
+		uint64_t out_buf = 0;
+
+		for (auto n = 0; n < 4; ++n) {
+			const auto pixels = _mm512_loadu_si512(in);
+			in += 16;
+
+			const auto bits = _mm512_test_epi32_mask(pixels, rgb_mask);
+			out_buf |= (uint64_t)bits << (n * 16);
+		}
+		*out = out_buf;
+		++out;
+	}
+}
+
+#endif // FMV_X86
+
+static ThresholdRowFunc select_threshold_row()
+{
+#ifdef FMV_X86
+	if (cpu_features.avx512f) {
+		return threshold_row_avx512;
+	}
+	if (cpu_features.avx2) {
+		return threshold_row_avx2;
+	}
+#endif
+	return threshold_row_scalar;
+}
+
+// Selected at startup based on the capabilities of the host CPU, and again
+// by set_kernel_isa()
+static ThresholdRowFunc threshold_row = select_threshold_row();
+
+// Converts 64 * num_words 8-bit luma samples into num_words mask words;
+// samples above the black level are set to 1
+using ThresholdLumaRowFunc = void (*)(const uint8_t* in, uint64_t* out,
+                                      const int num_words,
+                                      const uint8_t black_level);
+
+static void threshold_luma_row_scalar(const uint8_t* in, uint64_t* out,
+                                      const int num_words,
+                                      const uint8_t black_level)
+{
+	for (auto x = 0; x < num_words; ++x) {
+		uint64_t out_buf = 0;
+
+		for (auto n = 0; n < 64; ++n) {
+			out_buf |= (uint64_t)(in[n] > black_level) << n;
+		}
+		in += 64;
+
+		*out = out_buf;
+		++out;
+	}
+}
+
+#ifdef FMV_X86
+
+TARGET_AVX2
+static void threshold_luma_row_avx2(const uint8_t* in, uint64_t* out,
+                                    const int num_words,
+                                    const uint8_t black_level)
+{
+	// There's no unsigned byte compare in AVX2, so both sides are biased
+	// by 0x80 to turn it into a signed one
+	const auto bias  = _mm256_set1_epi8((char)0x80);
+	const auto black = _mm256_set1_epi8((char)(black_level ^ 0x80));
+
+	for (auto x = 0; x < num_words; ++x) {
+		uint64_t out_buf = 0;
+
+		// 32 samples per iteration, one movemask bit per sample
+		for (auto n = 0; n < 2; ++n) {
+			const auto luma = _mm256_loadu_si256(
+			        reinterpret_cast<const __m256i*>(in));
+			in += 32;
+
+			const auto is_set = _mm256_cmpgt_epi8(
+			        _mm256_xor_si256(luma, bias), black);
+
+			const auto bits = (uint32_t)_mm256_movemask_epi8(is_set);
+			out_buf |= (uint64_t)bits << (n * 32);
+		}
+		*out = out_buf;
+		++out;
+	}
+}
+
+TARGET_AVX512BW
+static void threshold_luma_row_avx512(const uint8_t* in, uint64_t* out,
+                                      const int num_words,
+                                      const uint8_t black_level)
+{
+	const auto black = _mm512_set1_epi8((char)black_level);
+
+	for (auto x = 0; x < num_words; ++x) {
+		// One 64-lane unsigned compare gives a whole mask word
+		const auto luma = _mm512_loadu_si512(in);
+		in += 64;
+
+		*out = _mm512_cmpgt_epu8_mask(luma, black);
+		++out;
+	}
+}
+
+#endif // FMV_X86
+
+static ThresholdLumaRowFunc select_threshold_luma_row()
+{
+#ifdef FMV_X86
+	if (cpu_features.avx512bw) {
+		return threshold_luma_row_avx512;
+	}
+	if (cpu_features.avx2) {
+		return threshold_luma_row_avx2;
+	}
+#endif
+	return threshold_luma_row_scalar;
+}
+
+// Selected at startup based on the capabilities of the host CPU, and again
+// by set_kernel_isa()
+static ThresholdLumaRowFunc threshold_luma_row = select_threshold_luma_row();
+
+void threshold(const MaskLayout& layout, const FrameView& src, MaskBuffer& dest)
+{
+	const TraceSpan span("threshold");
+
+	auto in       = src.pixels;
+	auto out_line = dest.data() + layout.offset + layout.pitch;
+
+	for (auto y = 0; y < layout.height; ++y) {
+		threshold_row(in, out_line, layout.width / 64);
+
+		in += src.pitch;
+		out_line += layout.pitch;
+	}
+}
+
+void downshift_and_xor(const MaskLayout& layout, MaskBuffer& src,
+                       MaskBuffer& dest)
+{
+	const TraceSpan span("downshift_and_xor");
+
+	dest.resize(src.size());
+
+	// Only the padding needs initialising; every data word is written
+	// below. That's the top and bottom padding rows, and the padding words
+	// at the start of each row.
+	std::fill_n(dest.begin(), layout.pitch, 0);
+	std::fill_n(dest.begin() + layout.pitch * (layout.height + 1),
+	            layout.pitch,
+	            0);
+
+	for (auto y = 1; y <= layout.height; ++y) {
+		std::fill_n(dest.begin() + layout.pitch * y, layout.offset, 0);
+	}
+
+	auto curr_line = src.data() + layout.offset + layout.pitch;
+	auto out_line  = dest.data() + layout.offset + layout.pitch;
+
+	// The first row has nothing above it, so it's kept as is
+	std::copy_n(curr_line, layout.width / 64, out_line);
+
+	for (auto y = 1; y < layout.height; ++y) {
+		const auto prev = curr_line;
+
+		curr_line += layout.pitch;
+		out_line += layout.pitch;
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			out_line[x] = curr_line[x] ^ prev[x];
+		}
+	}
+}
+
+static inline bool is_row_occupied(const RowOccupancy& occupancy, const int y)
+{
+	return (occupancy[y / 64] >> (y % 64)) & 1;
+}
+
+static inline void set_row_occupied(RowOccupancy& occupancy, const int y,
+                                    const bool occupied)
+{
+	const auto bit = (uint64_t)1 << (y % 64);
+	if (occupied) {
+		occupancy[y / 64] |= bit;
+	} else {
+		occupancy[y / 64] &= ~bit;
+	}
+}
+
+// Builds the occupancy summary of the first num_rows rows of a mask buffer
+void find_occupied_rows(const MaskLayout& layout, MaskBuffer& mask,
+                        RowOccupancy& occupancy, const int num_rows)
+{
+	const TraceSpan span("find_occupied_rows");
+
+	auto in_line = mask.data() + layout.offset + layout.pitch;
+
+	for (auto y = 0; y < num_rows; ++y) {
+		uint64_t any = 0;
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			any |= in_line[x];
+		}
+		set_row_occupied(occupancy, y, any);
+
+		in_line += layout.pitch;
+	}
+}
+
+// Shared loop of the fused threshold + XOR stages below;
+// `threshold_row_at(y, out)` thresholds mask row Y into `out`
+template <typename ThresholdRowAt>
+static void threshold_and_xor_rows(const MaskLayout& layout,
+                                   ThresholdRowAt threshold_row_at,
+                                   MaskBuffer& dest,
+                                   RowOccupancy& dest_occupancy,
+                                   MaskBuffer& prev_line, const int num_rows)
+{
+	const auto num_words = layout.width / 64;
+
+	auto out_line = dest.data() + layout.offset + layout.pitch;
+
+	// The first row has nothing above it, so it's kept as is
+	std::fill(prev_line.begin(), prev_line.begin() + num_words, 0);
+
+	for (auto y = 0; y < num_rows; ++y) {
+		threshold_row_at(y, out_line);
+
+		auto prev = prev_line.data();
+		auto out  = out_line;
+		uint64_t any = 0;
+
+		for (auto x = 0; x < num_words; ++x) {
+			const auto curr = *out;
+			*out ^= *prev;
+			any |= *out;
+			*prev = curr;
+			++prev;
+			++out;
+		}
+		set_row_occupied(dest_occupancy, y, any);
+
+		out_line += layout.pitch;
+	}
+}
+
+// Fused threshold() + downshift_and_xor(). Each row is thresholded straight
+// into its place in dest, then XOR-ed with the thresholded previous row kept
+// in `prev_line` (layout.width / 64 uint64_t's). This avoids writing, copying
+// and re-reading the full intermediate threshold buffer.
+//
+// Image rows first_row to first_row + num_rows - 1 are written to the mask
+// rows starting at the top of dest, and their occupancy to dest_occupancy.
+void threshold_and_xor(const MaskLayout& layout, const FrameView& src,
+                       MaskBuffer& dest, RowOccupancy& dest_occupancy,
+                       MaskBuffer& prev_line, const int first_row,
+                       const int num_rows)
+{
+	const TraceSpan span("threshold_and_xor");
+
+	const auto num_words = layout.width / 64;
+
+	auto threshold_row_at = [&](const int y, uint64_t* out) {
+		threshold_row(src.pixels + (first_row + y) * src.pitch,
+		              out,
+		              num_words);
+	};
+
+	threshold_and_xor_rows(layout,
+	                       threshold_row_at,
+	                       dest,
+	                       dest_occupancy,
+	                       prev_line,
+	                       num_rows);
+}
+
+// Same as threshold_and_xor(), but builds the mask from the luma plane of a
+// YUV frame alone; samples above `black_level` count as non-black. This
+// reads one byte per pixel instead of four.
+void threshold_luma_and_xor(const MaskLayout& layout, const PlaneView& luma,
+                            const uint8_t black_level, MaskBuffer& dest,
+                            RowOccupancy& dest_occupancy,
+                            MaskBuffer& prev_line, const int first_row,
+                            const int num_rows)
+{
+	const TraceSpan span("threshold_luma_and_xor");
+
+	const auto num_words = layout.width / 64;
+
+	auto threshold_row_at = [&](const int y, uint64_t* out) {
+		threshold_luma_row(luma.pixels + (first_row + y) * luma.pitch,
+		                   out,
+		                   num_words,
+		                   black_level);
+	};
+
+	threshold_and_xor_rows(layout,
+	                       threshold_row_at,
+	                       dest,
+	                       dest_occupancy,
+	                       prev_line,
+	                       num_rows);
+}
+
+void dilate_horiz(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest)
+{
+	const TraceSpan span("dilate_horiz");
+
+	auto in_line  = src.data() + layout.pitch + 1;
+	auto out_line = dest.data() + layout.pitch + 1;
+
+	for (auto y = 0; y < layout.height; ++y) {
+		auto in  = in_line;
+		auto out = out_line;
+
+		// We process the input horizontally in 64-pixel chunks.
+		// This is the layout of a single chunk in an uint64_t:
+		//
+		//    bits         pixels
+		//
+		//    0-7    pixels N    to N+7
+		//    8-15   pixels N+8  to N+15
+		//   16-23   pixels N+16 to N+23
+		//    ...            ...
+		//   48-55   pixels N+48 to N+55
+		//   56-63   pixels N+56 to N+63
+		//
+		uint64_t curr = *in++;
+		uint64_t prev = 0;
+
+		for (auto x = 0; x < layout.width / 64 + 1; ++x) {
+			const auto next = *in;
+			++in;
+
+			// "Shift in" the last pixel of the previous chunk
+			const auto prev_pixel63 = (prev & ((uint64_t)1 << 63)) >> 63;
+			const auto left_neighbours = (curr << 1) | prev_pixel63;
+
+			// "Shift in" the firs pixel of the next chunk
+			const auto next_pixel1      = (next & 1) << 63;
+			const auto right_neighbours = next_pixel1 | curr >> 1;
+
+			*out = left_neighbours | curr | right_neighbours;
+			++out;
+
+			prev = curr;
+			curr = next;
+		}
+
+		in_line += layout.pitch;
+		out_line += layout.pitch;
+	}
+}
+
+void dilate_vert(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest)
+{
+	const TraceSpan span("dilate_vert");
+
+	auto in_line  = src.data() + layout.offset + layout.pitch;
+	auto out_line = dest.data() + layout.offset + layout.pitch;
+
+	for (auto y = 0; y < layout.height; ++y) {
+		auto in  = in_line;
+		auto out = out_line;
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const auto prev = *(in - layout.pitch);
+			const auto curr = *in;
+			const auto next = *(in + layout.pitch);
+
+			*out = prev | curr | next;
+
+			++in;
+			++out;
+		}
+
+		in_line += layout.pitch;
+		out_line += layout.pitch;
+	}
+}
+
+void erode_horiz(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest)
+{
+	const TraceSpan span("erode_horiz");
+
+	auto in_line  = src.data() + layout.pitch + 1;
+	auto out_line = dest.data() + layout.pitch + 1;
+
+	for (auto y = 0; y < layout.height; ++y) {
+		auto in  = in_line;
+		auto out = out_line;
+
+		// We process the input horizontally in 64-pixel chunks.
+		// This is the layout of a single chunk in an uint64_t:
+		//
+		//    bits         pixels
+		//
+		//    0-7    pixels N    to N+7
+		//    8-15   pixels N+8  to N+15
+		//   16-23   pixels N+16 to N+23
+		//    ...            ...
+		//   48-55   pixels N+48 to N+55
+		//   56-63   pixels N+56 to N+63
+		//
+		uint64_t curr = *in++;
+		uint64_t prev = 0;
+
+		for (auto x = 0; x < layout.width / 64 + 1; ++x) {
+			const auto next = *in;
+			++in;
+
+			// "Shift in" the last pixel of the previous chunk
+			const auto prev_pixel63 = (prev & ((uint64_t)1 << 63)) >> 63;
+			const auto left_neighbours = (curr << 1) | prev_pixel63;
+
+			// "Shift in" the firs pixel of the next chunk
+			const auto next_pixel1      = (next & 1) << 63;
+			const auto right_neighbours = next_pixel1 | curr >> 1;
+
+			*out = left_neighbours & curr & right_neighbours;
+			++out;
+
+			prev = curr;
+			curr = next;
+		}
+
+		in_line += layout.pitch;
+		out_line += layout.pitch;
+	}
+}
+
+void erode_vert(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest)
+{
+	const TraceSpan span("erode_vert");
+
+	auto in_line  = src.data() + layout.offset + layout.pitch;
+	auto out_line = dest.data() + layout.offset + layout.pitch;
+
+	for (auto y = 0; y < layout.height; ++y) {
+		auto in  = in_line;
+		auto out = out_line;
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const auto prev = *(in - layout.pitch);
+			const auto curr = *in;
+			const auto next = *(in + layout.pitch);
+
+			*out = prev & curr & next;
+
+			++in;
+			++out;
+		}
+
+		in_line += layout.pitch;
+		out_line += layout.pitch;
+	}
+}
+
+enum class MorphOp { Erode, Dilate };
+
+// Same as erode_horiz()/dilate_horiz() for a single row of num_words mask
+// words; pixels outside the row are treated as zero. Returns non-zero if any
+// output bits are set.
+template <MorphOp Op>
+static uint64_t morph_row_horiz(const uint64_t* in, uint64_t* out,
+                                const int num_words)
+{
+	uint64_t any  = 0;
+	uint64_t prev = 0;
+	uint64_t curr = in[0];
+
+	for (auto x = 0; x < num_words; ++x) {
+		const auto next = (x + 1 < num_words) ? in[x + 1] : 0;
+
+		const auto left_neighbours  = (curr << 1) | (prev >> 63);
+		const auto right_neighbours = (curr >> 1) | (next << 63);
+
+		if constexpr (Op == MorphOp::Erode) {
+			out[x] = left_neighbours & curr & right_neighbours;
+		} else {
+			out[x] = left_neighbours | curr | right_neighbours;
+		}
+		any |= out[x];
+
+		prev = curr;
+		curr = next;
+	}
+	return any;
+}
+
+// Same as erode_vert()/dilate_vert() for a single output row. Returns non-zero
+// if any output bits are set.
+template <MorphOp Op>
+static uint64_t morph_row_vert(const uint64_t* prev, const uint64_t* curr,
+                               const uint64_t* next, uint64_t* out,
+                               const int num_words)
+{
+	uint64_t any = 0;
+
+	for (auto x = 0; x < num_words; ++x) {
+		if constexpr (Op == MorphOp::Erode) {
+			out[x] = prev[x] & curr[x] & next[x];
+		} else {
+			out[x] = prev[x] | curr[x] | next[x];
+		}
+		any |= out[x];
+	}
+	return any;
+}
+
+// Fused morphological opening; gives the same result as
+//
+//   2x erode_horiz + erode_vert, then 2x dilate_horiz + dilate_vert
+//
+// but streams the rows through a small ring of line buffers so each mask row
+// is read and written only once.
+//
+// There are four levels (erode, erode, dilate, dilate), each keeping the
+// last three horizontally processed rows of the level before it in a ring.
+// Level K produces row Y once row Y + 1 of level K - 1 is available, so the
+// final output lags the input by four rows. Because of this, src and dest
+// (and their occupancy summaries) can be the same buffers.
+//
+// Rows known to be empty are never loaded: empty input rows are skipped
+// using src_occupancy, eroding anything next to an empty row gives an empty
+// row, and dilating three empty rows does too. The occupancy of the final
+// rows is written to dest_occupancy.
+//
+// `line_buffers` must hold at least OpenMaskNumLines * layout.width / 64
+// uint64_t's. Only the first num_rows mask rows are processed.
+void open_mask(const MaskLayout& layout, MaskBuffer& src,
+               RowOccupancy& src_occupancy, MaskBuffer& dest,
+               RowOccupancy& dest_occupancy,
+               MaskBuffer& line_buffers, const int num_rows)
+{
+	const TraceSpan span("open_mask");
+
+	constexpr auto NumLevels = 4;
+	constexpr auto RingSize  = 3;
+
+	const auto num_words = layout.width / 64;
+
+	// Ring K holds rows Y - 1, Y and Y + 1 of level K - 1 after the
+	// horizontal pass of level K, at index (Y mod 3). Rows outside of the
+	// image are all zeroes, like the padding rows of the full buffers.
+	// Empty rows are always stored as zeroes; their flag only lets us skip
+	// the work.
+	auto ring_slot = [](const int y) {
+		return (y + RingSize) % RingSize;
+	};
+	auto ring_row = [&](const int level, const int y) {
+		return line_buffers.data() +
+		       (level * RingSize + ring_slot(y)) * num_words;
+	};
+	bool ring_occupied[NumLevels][RingSize] = {};
+
+	auto tmp_row = line_buffers.data() + NumLevels * RingSize * num_words;
+
+	std::fill(line_buffers.begin(),
+	          line_buffers.begin() + OpenMaskNumLines * num_words,
+	          0);
+
+	// Stores the horizontal pass of a row into the ring of a level; a null
+	// `in` row stores an empty row
+	auto push_row = [&](const int level, const uint64_t* in, const int y) {
+		const auto out = ring_row(level, y);
+		if (!in) {
+			std::fill_n(out, num_words, 0);
+			ring_occupied[level][ring_slot(y)] = false;
+			return;
+		}
+
+		uint64_t any = 0;
+		if (level < 2) {
+			any = morph_row_horiz<MorphOp::Erode>(in, out, num_words);
+		} else {
+			any = morph_row_horiz<MorphOp::Dilate>(in, out, num_words);
+		}
+		ring_occupied[level][ring_slot(y)] = (any != 0);
+	};
+
+	// Vertical pass of a level from its ring. Returns false without
+	// touching `out` if the resulting row is known to be empty.
+	auto vert = [&](const int level, const int y, uint64_t* out) {
+		const auto& occupied = ring_occupied[level];
+
+		const auto prev_occupied = occupied[ring_slot(y - 1)];
+		const auto curr_occupied = occupied[ring_slot(y)];
+		const auto next_occupied = occupied[ring_slot(y + 1)];
+
+		const auto prev = ring_row(level, y - 1);
+		const auto curr = ring_row(level, y);
+		const auto next = ring_row(level, y + 1);
+
+		uint64_t any = 0;
+		if (level < 2) {
+			if (prev_occupied && curr_occupied && next_occupied) {
+				any = morph_row_vert<MorphOp::Erode>(
+				        prev, curr, next, out, num_words);
+			}
+		} else {
+			if (prev_occupied || curr_occupied || next_occupied) {
+				any = morph_row_vert<MorphOp::Dilate>(
+				        prev, curr, next, out, num_words);
+			}
+		}
+		return any != 0;
+	};
+
+	const auto in_line  = src.data() + layout.offset + layout.pitch;
+	const auto out_line = dest.data() + layout.offset + layout.pitch;
+
+	for (auto t = 0; t < num_rows + NumLevels; ++t) {
+		// Feed the next input row into the first ring
+		if (t < num_rows && is_row_occupied(src_occupancy, t)) {
+			push_row(0, in_line + t * layout.pitch, t);
+		} else {
+			push_row(0, nullptr, t);
+		}
+
+		// Then let every level produce its row from the three rows
+		// available in its ring
+		for (auto level = 0; level < NumLevels; ++level) {
+			const auto y = t - 1 - level;
+			if (y < 0) {
+				break;
+			}
+			const auto is_last_level = (level == NumLevels - 1);
+
+			if (y >= num_rows) {
+				if (!is_last_level) {
+					push_row(level + 1, nullptr, y);
+				}
+				continue;
+			}
+			if (is_last_level) {
+				const auto out = out_line + y * layout.pitch;
+
+				const auto occupied = vert(level, y, out);
+				if (!occupied) {
+					std::fill_n(out, num_words, 0);
+				}
+				set_row_occupied(dest_occupancy, y, occupied);
+			} else {
+				const auto occupied = vert(level, y, tmp_row);
+				push_row(level + 1, occupied ? tmp_row : nullptr, y);
+			}
+		}
+	}
+}
+
+// Deinterlacing strength params
+//
+// low     1 / 2
+// medium  2 / 3
+// high    4 / 5
+// subtle  8 / 9
+// full    1 / 1
+
+// Replace the divide with mul+shift approx: the strength ratio is turned
+// into a multiplier in 1/256 units at compile time, rounded down so e.g.
+// subtle becomes 227/256 ≈ 0.8867 ~ 8/9 (0.8889). Good enough for video.
+constexpr uint32_t blend_multiplier(const uint32_t numerator,
+                                    const uint32_t denominator)
+{
+	return numerator * 256 / denominator;
+}
+
+bool parse_strength(const std::string_view name, Strength& strength)
+{
+	if (name == "low") {
+		strength = Strength::Low;
+	} else if (name == "medium") {
+		strength = Strength::Medium;
+	} else if (name == "high") {
+		strength = Strength::High;
+	} else if (name == "subtle") {
+		strength = Strength::Subtle;
+	} else if (name == "full") {
+		strength = Strength::Full;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Indexed by Strength
+constexpr uint32_t StrengthMultipliers[NumStrengths] = {
+        blend_multiplier(1, 2),
+        blend_multiplier(2, 3),
+        blend_multiplier(4, 5),
+        blend_multiplier(8, 9),
+        blend_multiplier(1, 1),
+};
+
+template <uint32_t Multiplier>
+static inline uint32_t scale_rgb(uint32_t color)
+{
+    auto scale = [](uint32_t c) -> uint32_t {
+        return (c * Multiplier + 128) >> 8; // 0..255
+    };
+
+    const auto r =  scale( color        & 0xff);
+    const auto g = (scale((color >> 8)  & 0xff) << 8);
+    const auto b = (scale((color >> 16) & 0xff) << 16);
+    return r | g | b;
+}
+
+template <uint32_t Multiplier>
+void apply_masked_bleed_64(uint64_t m, const uint32_t* in, uint32_t* out)
+{
+    while (m) {
+        const auto k = std::countr_zero(m);
+        const auto in_buf = in[k];
+        const auto scaled = scale_rgb<Multiplier>(in_buf);
+        out[k] |= scaled;
+
+        m &= (m - 1); // clear lowest set bit
+    }
+}
+
+// Blends all 64 pixels of a mask word at once; cheaper than the bit walk in
+// apply_masked_bleed_64() for mask words with many bits set
+using DenseBleedFunc = void (*)(uint64_t m, const uint32_t* in, uint32_t* out);
+
+#ifdef FMV_X86
+
+// Multipliers for the 16-bit R, G, B and A lanes of an unpacked pixel; alpha
+// is scaled by zero so the scaled colour has no alpha, just like scale_rgb()
+template <uint32_t Multiplier>
+constexpr int64_t PixelMultipliers = ((int64_t)Multiplier << 32) |
+                                     ((int64_t)Multiplier << 16) | Multiplier;
+
+template <uint32_t Multiplier>
+TARGET_AVX2
+static void apply_masked_bleed_64_avx2(uint64_t m, const uint32_t* in,
+                                       uint32_t* out)
+{
+	const auto multipliers = _mm256_set1_epi64x(PixelMultipliers<Multiplier>);
+	const auto rounding    = _mm256_set1_epi16(128);
+	const auto zero        = _mm256_setzero_si256();
+
+	// Lane N of the expanded mask tests bit N of a mask byte
+	const auto lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+	for (auto n = 0; n < 8; ++n) {
+		const auto bits = (int)(m >> (n * 8)) & 0xff;
+		if (!bits) {
+			continue;
+		}
+
+		// Expand 8 mask bits into 8 all-zeroes or all-ones lanes
+		const auto lane_mask = _mm256_cmpeq_epi32(
+		        _mm256_and_si256(_mm256_set1_epi32(bits), lane_bits),
+		        lane_bits);
+
+		const auto pixels = _mm256_loadu_si256(
+		        reinterpret_cast<const __m256i*>(in + n * 8));
+
+		// (c * Multiplier + 128) >> 8 on 16-bit lanes, then pack back
+		// to bytes; unpack and pack both work within 128-bit halves, so
+		// the pixel order is preserved
+		auto lo = _mm256_unpacklo_epi8(pixels, zero);
+		auto hi = _mm256_unpackhi_epi8(pixels, zero);
+
+		lo = _mm256_srli_epi16(
+		        _mm256_add_epi16(_mm256_mullo_epi16(lo, multipliers),
+		                         rounding),
+		        8);
+		hi = _mm256_srli_epi16(
+		        _mm256_add_epi16(_mm256_mullo_epi16(hi, multipliers),
+		                         rounding),
+		        8);
+
+		const auto scaled = _mm256_packus_epi16(lo, hi);
+
+		const auto dest = reinterpret_cast<__m256i*>(out + n * 8);
+		const auto blended = _mm256_or_si256(
+		        _mm256_loadu_si256(dest),
+		        _mm256_and_si256(scaled, lane_mask));
+
+		_mm256_storeu_si256(dest, blended);
+	}
+}
+
+template <uint32_t Multiplier>
+TARGET_AVX512BW
+static void apply_masked_bleed_64_avx512(uint64_t m, const uint32_t* in,
+                                         uint32_t* out)
+{
+	const auto multipliers = _mm512_set1_epi64(PixelMultipliers<Multiplier>);
+	const auto rounding    = _mm512_set1_epi16(128);
+	const auto zero        = _mm512_setzero_si512();
+
+	// A mask word covers 64 pixels, which is four 16-lane registers, so
+	// each 16-bit quarter of it can be used directly as a write mask
+	for (auto n = 0; n < 4; ++n) {
+		const auto lane_mask = (__mmask16)(m >> (n * 16));
+		if (!lane_mask) {
+			continue;
+		}
+
+		const auto pixels = _mm512_loadu_si512(in + n * 16);
+
+		// Same scaling as in scale_rgb()
+		auto lo = _mm512_unpacklo_epi8(pixels, zero);
+		auto hi = _mm512_unpackhi_epi8(pixels, zero);
+
+		lo = _mm512_srli_epi16(
+		        _mm512_add_epi16(_mm512_mullo_epi16(lo, multipliers),
+		                         rounding),
+		        8);
+		hi = _mm512_srli_epi16(
+		        _mm512_add_epi16(_mm512_mullo_epi16(hi, multipliers),
+		                         rounding),
+		        8);
+
+		const auto scaled = _mm512_packus_epi16(lo, hi);
+
+		const auto dest    = out + n * 16;
+		const auto current = _mm512_loadu_si512(dest);
+
+		_mm512_mask_storeu_epi32(dest,
+		                         lane_mask,
+		                         _mm512_or_si512(current, scaled));
+	}
+}
+
+#endif // FMV_X86
+
+struct BleedBackend {
+	DenseBleedFunc dense_bleed = nullptr;
+
+	// Mask words with at least this many bits set use dense_bleed, the
+	// rest the bit walk
+	int dense_min_bits = 0;
+};
+
+template <uint32_t Multiplier>
+static BleedBackend select_bleed_backend()
+{
+#ifdef FMV_X86
+	if (cpu_features.avx512bw) {
+		return {apply_masked_bleed_64_avx512<Multiplier>, 6};
+	}
+	if (cpu_features.avx2) {
+		return {apply_masked_bleed_64_avx2<Multiplier>, 12};
+	}
+#endif
+	// There's no dense scalar kernel; always walk the bits
+	return {apply_masked_bleed_64<Multiplier>, 65};
+}
+
+static std::array<BleedBackend, NumStrengths> select_bleed_backends()
+{
+	return {
+	        select_bleed_backend<StrengthMultipliers[0]>(),
+	        select_bleed_backend<StrengthMultipliers[1]>(),
+	        select_bleed_backend<StrengthMultipliers[2]>(),
+	        select_bleed_backend<StrengthMultipliers[3]>(),
+	        select_bleed_backend<StrengthMultipliers[4]>(),
+	};
+}
+
+// Selected at startup based on the capabilities of the host CPU, and again
+// by set_kernel_isa(); indexed by Strength
+static std::array<BleedBackend, NumStrengths> bleed_backends =
+        select_bleed_backends();
+
+bool set_kernel_isa(const KernelIsa isa)
+{
+#ifdef FMV_X86
+	CpuFeatures features = {};
+
+	if (isa == KernelIsa::Auto) {
+		features = host_cpu_features;
+
+	} else if (isa == KernelIsa::Avx2) {
+		if (!host_cpu_features.avx2) {
+			return false;
+		}
+		features.avx2 = true;
+
+	} else if (isa == KernelIsa::Avx512) {
+		// Not all of the AVX-512 kernels would be used without AVX-512BW
+		if (!host_cpu_features.avx512bw) {
+			return false;
+		}
+		features = host_cpu_features;
+	}
+	cpu_features = features;
+#else
+	if (isa != KernelIsa::Auto && isa != KernelIsa::Scalar) {
+		return false;
+	}
+#endif
+	threshold_row      = select_threshold_row();
+	threshold_luma_row = select_threshold_luma_row();
+	bleed_backends     = select_bleed_backends();
+
+	return true;
+}
+
+template <uint32_t Multiplier>
+static void deinterlace_rows_impl(const MaskLayout& layout,
+                                  const FrameView& src,
+                                  MaskBuffer& mask,
+                                  RowOccupancy& occupancy,
+                                  const FrameView& dest,
+                                  const int first_row, const int last_row,
+                                  const int mask_first_row,
+                                  const BleedBackend& backend)
+{
+	for (auto y = first_row; y < last_row; ++y) {
+		std::copy_n(src.pixels + y * src.pitch,
+		            layout.width,
+		            dest.pixels + y * dest.pitch);
+	}
+
+	// The first image row has no row above it to bleed from
+	auto y = std::max(first_row, 1);
+
+	while (y < last_row) {
+		// Find the next occupied row, skipping whole empty 64-row blocks
+		// in one step
+		const auto mask_row = y - mask_first_row;
+		const auto block    = occupancy[mask_row / 64] >> (mask_row % 64);
+		if (!block) {
+			y += 64 - mask_row % 64;
+			continue;
+		}
+		y += std::countr_zero(block);
+		if (y >= last_row) {
+			break;
+		}
+
+		const auto in        = src.pixels + (y - 1) * src.pitch;
+		const auto out       = dest.pixels + y * dest.pitch;
+		const auto mask_line = mask.data() + layout.offset +
+		                       layout.pitch * (y - mask_first_row + 1);
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const uint64_t m = mask_line[x];
+			if (!m) {
+				continue;
+			}
+			// 64 pixels = 64 uint32_t
+			if (std::popcount(m) >= backend.dense_min_bits) {
+				backend.dense_bleed(m, in + x * 64, out + x * 64);
+			} else {
+				apply_masked_bleed_64<Multiplier>(m,
+				                                  in + x * 64,
+				                                  out + x * 64);
+			}
+		}
+		++y;
+	}
+}
+
+using DeinterlaceRowsFunc = void (*)(const MaskLayout& layout,
+                                     const FrameView& src,
+                                     MaskBuffer& mask,
+                                     RowOccupancy& occupancy,
+                                     const FrameView& dest,
+                                     const int first_row, const int last_row,
+                                     const int mask_first_row,
+                                     const BleedBackend& backend);
+
+// Indexed by Strength
+static constexpr DeinterlaceRowsFunc deinterlace_rows_funcs[NumStrengths] = {
+        deinterlace_rows_impl<StrengthMultipliers[0]>,
+        deinterlace_rows_impl<StrengthMultipliers[1]>,
+        deinterlace_rows_impl<StrengthMultipliers[2]>,
+        deinterlace_rows_impl<StrengthMultipliers[3]>,
+        deinterlace_rows_impl<StrengthMultipliers[4]>,
+};
+
+// Deinterlaces image rows first_row to last_row - 1 of src into the same rows
+// of dest. Image row Y uses mask row Y - mask_first_row. Rows that are empty
+// according to the mask's occupancy summary are only copied.
+//
+// The strength is selected once per call; every strength has its own
+// pre-instantiated kernels with the multiplier baked in.
+void deinterlace_rows(const MaskLayout& layout, const FrameView& src,
+                      MaskBuffer& mask, RowOccupancy& occupancy,
+                      const FrameView& dest,
+                      const int first_row, const int last_row,
+                      const int mask_first_row, const Strength strength)
+{
+	const TraceSpan span("deinterlace_rows");
+
+	const auto index = static_cast<int>(strength);
+
+	deinterlace_rows_funcs[index](layout,
+	                              src,
+	                              mask,
+	                              occupancy,
+	                              dest,
+	                              first_row,
+	                              last_row,
+	                              mask_first_row,
+	                              bleed_backends[index]);
+}
+
+void deinterlace(const MaskLayout& layout, const FrameView& src,
+                 MaskBuffer& mask, RowOccupancy& occupancy,
+                 const FrameView& dest, const Strength strength)
+{
+	const TraceSpan span("deinterlace");
+
+	deinterlace_rows(layout,
+	                 src,
+	                 mask,
+	                 occupancy,
+	                 dest,
+	                 0,
+	                 layout.height,
+	                 0,
+	                 strength);
+}
+
+template <uint32_t Multiplier>
+static void deinterlace_rows_in_place_impl(const MaskLayout& layout,
+                                           const FrameView& frame,
+                                           MaskBuffer& mask,
+                                           RowOccupancy& occupancy,
+                                           const int first_row,
+                                           const int last_row,
+                                           const int mask_first_row,
+                                           const uint32_t* row_above,
+                                           const BleedBackend& backend)
+{
+	// The first image row has no row above it to bleed from
+	const auto stop_row = std::max(first_row, 1);
+
+	// Rows are processed bottom-up, so the row above the current one is
+	// always still unmodified
+	auto y = last_row - 1;
+
+	while (y >= stop_row) {
+		// Find the next occupied row upwards, skipping whole empty
+		// 64-row blocks in one step
+		const auto mask_row = y - mask_first_row;
+		const auto block    = occupancy[mask_row / 64] << (63 - mask_row % 64);
+		if (!block) {
+			y -= mask_row % 64 + 1;
+			continue;
+		}
+		y -= std::countl_zero(block);
+		if (y < stop_row) {
+			break;
+		}
+
+		const auto in = (y == first_row)
+		                      ? row_above
+		                      : frame.pixels + (y - 1) * frame.pitch;
+
+		const auto out       = frame.pixels + y * frame.pitch;
+		const auto mask_line = mask.data() + layout.offset +
+		                       layout.pitch * (y - mask_first_row + 1);
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const uint64_t m = mask_line[x];
+			if (!m) {
+				continue;
+			}
+			// 64 pixels = 64 uint32_t
+			if (std::popcount(m) >= backend.dense_min_bits) {
+				backend.dense_bleed(m, in + x * 64, out + x * 64);
+			} else {
+				apply_masked_bleed_64<Multiplier>(m,
+				                                  in + x * 64,
+				                                  out + x * 64);
+			}
+		}
+		--y;
+	}
+}
+
+using DeinterlaceRowsInPlaceFunc = void (*)(const MaskLayout& layout,
+                                            const FrameView& frame,
+                                            MaskBuffer& mask,
+                                            RowOccupancy& occupancy,
+                                            const int first_row,
+                                            const int last_row,
+                                            const int mask_first_row,
+                                            const uint32_t* row_above,
+                                            const BleedBackend& backend);
+
+// Indexed by Strength
+static constexpr DeinterlaceRowsInPlaceFunc
+        deinterlace_rows_in_place_funcs[NumStrengths] = {
+        deinterlace_rows_in_place_impl<StrengthMultipliers[0]>,
+        deinterlace_rows_in_place_impl<StrengthMultipliers[1]>,
+        deinterlace_rows_in_place_impl<StrengthMultipliers[2]>,
+        deinterlace_rows_in_place_impl<StrengthMultipliers[3]>,
+        deinterlace_rows_in_place_impl<StrengthMultipliers[4]>,
+};
+
+// In-place version of deinterlace_rows(); only the masked pixels of the
+// frame are written, and there's no full-frame copy. The first row of the
+// range bleeds from `row_above`, which must hold an unmodified copy of image
+// row first_row - 1 when another thread may be modifying that row (unused
+// when first_row is 0).
+void deinterlace_rows_in_place(const MaskLayout& layout, const FrameView& frame,
+                               MaskBuffer& mask,
+                               RowOccupancy& occupancy, const int first_row,
+                               const int last_row, const int mask_first_row,
+                               const uint32_t* row_above,
+                               const Strength strength)
+{
+	const TraceSpan span("deinterlace_rows_in_place");
+
+	const auto index = static_cast<int>(strength);
+
+	deinterlace_rows_in_place_funcs[index](layout,
+	                                       frame,
+	                                       mask,
+	                                       occupancy,
+	                                       first_row,
+	                                       last_row,
+	                                       mask_first_row,
+	                                       row_above,
+	                                       bleed_backends[index]);
+}
+
+void deinterlace_in_place(const MaskLayout& layout, const FrameView& frame,
+                          MaskBuffer& mask, RowOccupancy& occupancy,
+                          const Strength strength)
+{
+	const TraceSpan span("deinterlace_in_place");
+
+	deinterlace_rows_in_place(layout,
+	                          frame,
+	                          mask,
+	                          occupancy,
+	                          0,
+	                          layout.height,
+	                          0,
+	                          nullptr,
+	                          strength);
+}
+
+// Per-plane versions of scale_rgb() for 8-bit YUV samples. Luma is scaled
+// towards the black level and chroma towards the neutral 128, which is what
+// scaling the RGB channels towards zero amounts to.
+template <uint32_t Multiplier>
+static inline uint8_t scale_luma(const uint8_t luma, const uint8_t black_level)
+{
+	const auto delta = std::max((int)luma - black_level, 0);
+	return (uint8_t)(black_level + ((delta * (int)Multiplier + 128) >> 8));
+}
+
+template <uint32_t Multiplier>
+static inline uint8_t scale_chroma(const uint8_t chroma)
+{
+	const auto delta = (int)chroma - 128;
+	return (uint8_t)(128 + ((delta * (int)Multiplier + 128) >> 8));
+}
+
+// The 4:2:0 version of scale_chroma(). The black row of the FMV pulled every
+// chroma sample of the region halfway towards the neutral 128 when the
+// frame was subsampled, as a chroma row covers one image row and one black
+// row. Once the black row is filled with the scaled image row, the sample
+// should be the average of the image chroma and the scaled image chroma,
+// which works out to delta * (1 + multiplier) in terms of the stored delta.
+template <uint32_t Multiplier>
+static inline uint8_t scale_chroma_420(const uint8_t chroma)
+{
+	const auto delta  = (int)chroma - 128;
+	const auto scaled = 128 + ((delta * (256 + (int)Multiplier) + 128) >> 8);
+	return (uint8_t)std::clamp(scaled, 0, 255);
+}
+
+// Chroma step of deinterlace_yuv_rows_in_place_impl() for 4:2:0 frames. It
+// runs before the luma step, and blends a chroma sample when any of the luma
+// pixels it covers is going to be filled, i.e. is masked and still black.
+// Chroma row C belongs to the range that has luma row 2C + 1 (or 2C in the
+// single luma row chroma row of an odd height), so a range split at an odd
+// row doesn't blend any sample twice. Luma row 2C is then the row above the
+// range, which is read from the unmodified copy in `rows_above`.
+template <uint32_t Multiplier>
+static void blend_chroma_420_rows(const MaskLayout& layout,
+                                  const YuvFrameView& frame,
+                                  MaskBuffer& mask, RowOccupancy& occupancy,
+                                  const int first_row, const int last_row,
+                                  const int mask_first_row,
+                                  const uint8_t* rows_above)
+{
+	// Every other bit, one for each chroma sample of a mask word
+	constexpr uint64_t EvenBits = 0x5555555555555555;
+
+	const auto height = layout.height;
+
+	// The first image row has no row above it, so it's never filled
+	auto may_fill_row = [&](const int y) {
+		return y > 0 && y < height &&
+		       is_row_occupied(occupancy, y - mask_first_row);
+	};
+
+	// The luma pixels of a mask word the luma step will fill
+	auto fill_bits = [&](const int y, const int x) -> uint64_t {
+		const auto m = mask[layout.offset +
+		                    layout.pitch * (y - mask_first_row + 1) + x];
+		if (!m) {
+			return 0;
+		}
+		const auto luma = (y < first_row)
+		                        ? rows_above
+		                        : frame.y.pixels + y * frame.y.pitch;
+
+		uint64_t non_black = 0;
+		threshold_luma_row(luma + x * 64, &non_black, 1, frame.black_level);
+
+		return m & ~non_black;
+	};
+
+	const auto first_chroma_row = first_row / 2;
+	const auto last_chroma_row  = (last_row == height) ? (height + 1) / 2
+	                                                   : last_row / 2;
+
+	for (auto c = first_chroma_row; c < last_chroma_row; ++c) {
+		const auto top    = may_fill_row(c * 2);
+		const auto bottom = may_fill_row(c * 2 + 1);
+		if (!top && !bottom) {
+			continue;
+		}
+
+		const auto out_u = frame.u.pixels + c * frame.u.pitch;
+		const auto out_v = frame.v.pixels + c * frame.v.pitch;
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const auto fill = (top ? fill_bits(c * 2, x) : 0) |
+			                  (bottom ? fill_bits(c * 2 + 1, x) : 0);
+
+			// A chroma sample covers two luma columns
+			auto samples = (fill | (fill >> 1)) & EvenBits;
+
+			while (samples) {
+				const auto k = x * 32 + std::countr_zero(samples) / 2;
+
+				out_u[k] = scale_chroma_420<Multiplier>(out_u[k]);
+				out_v[k] = scale_chroma_420<Multiplier>(out_v[k]);
+
+				samples &= (samples - 1); // clear lowest set bit
+			}
+		}
+	}
+}
+
+template <uint32_t Multiplier>
+static void deinterlace_yuv_rows_in_place_impl(const MaskLayout& layout,
+                                               const YuvFrameView& frame,
+                                               MaskBuffer& mask,
+                                               RowOccupancy& occupancy,
+                                               const int first_row,
+                                               const int last_row,
+                                               const int mask_first_row,
+                                               const uint8_t* rows_above)
+{
+	const auto full_chroma = (frame.subsampling == ChromaSubsampling::Yuv444);
+	const auto black_level = frame.black_level;
+
+	// Needs the luma rows before they're filled
+	if (!full_chroma) {
+		blend_chroma_420_rows<Multiplier>(layout,
+		                                  frame,
+		                                  mask,
+		                                  occupancy,
+		                                  first_row,
+		                                  last_row,
+		                                  mask_first_row,
+		                                  rows_above);
+	}
+
+	// The first image row has no row above it to bleed from
+	const auto stop_row = std::max(first_row, 1);
+
+	// Rows are processed bottom-up, so the row above the current one is
+	// always still unmodified
+	auto y = last_row - 1;
+
+	while (y >= stop_row) {
+		// Find the next occupied row upwards, skipping whole empty
+		// 64-row blocks in one step
+		const auto mask_row = y - mask_first_row;
+		const auto block    = occupancy[mask_row / 64] << (63 - mask_row % 64);
+		if (!block) {
+			y -= mask_row % 64 + 1;
+			continue;
+		}
+		y -= std::countl_zero(block);
+		if (y < stop_row) {
+			break;
+		}
+
+		auto plane_row = [&](const PlaneView& plane, const int row) {
+			return plane.pixels + row * plane.pitch;
+		};
+		auto plane_row_above = [&](const PlaneView& plane, const int index) {
+			return (y == first_row)
+			             ? rows_above + index * layout.width
+			             : plane_row(plane, y - 1);
+		};
+
+		const auto in_y  = plane_row_above(frame.y, 0);
+		const auto out_y = plane_row(frame.y, y);
+
+		const auto in_u  = full_chroma ? plane_row_above(frame.u, 1) : nullptr;
+		const auto in_v  = full_chroma ? plane_row_above(frame.v, 2) : nullptr;
+		const auto out_u = full_chroma ? plane_row(frame.u, y) : nullptr;
+		const auto out_v = full_chroma ? plane_row(frame.v, y) : nullptr;
+
+		const auto mask_line = mask.data() + layout.offset +
+		                       layout.pitch * (y - mask_first_row + 1);
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const uint64_t m = mask_line[x];
+			if (!m) {
+				continue;
+			}
+			// The RGB blend ORs the scaled pixel above into every
+			// masked pixel. That fills the black ones and can only
+			// brighten the others, so it needs no per-pixel test.
+			// An OR doesn't work on YUV: luma starts at the black
+			// level and chroma is centered on 128, so ORing in bits
+			// would shift the colors. Instead, only the masked
+			// pixels that are still black get replaced by the scaled
+			// pixel above, and the non-black ones are left as is.
+			uint64_t non_black = 0;
+			threshold_luma_row(out_y + x * 64, &non_black, 1, black_level);
+
+			auto fill = m & ~non_black;
+
+			while (fill) {
+				const auto k = x * 64 + std::countr_zero(fill);
+
+				out_y[k] = scale_luma<Multiplier>(in_y[k], black_level);
+				if (full_chroma) {
+					out_u[k] = scale_chroma<Multiplier>(in_u[k]);
+					out_v[k] = scale_chroma<Multiplier>(in_v[k]);
+				}
+				fill &= (fill - 1); // clear lowest set bit
+			}
+		}
+		--y;
+	}
+}
+
+using DeinterlaceYuvRowsInPlaceFunc = void (*)(const MaskLayout& layout,
+                                               const YuvFrameView& frame,
+                                               MaskBuffer& mask,
+                                               RowOccupancy& occupancy,
+                                               const int first_row,
+                                               const int last_row,
+                                               const int mask_first_row,
+                                               const uint8_t* rows_above);
+
+// Indexed by Strength
+static constexpr DeinterlaceYuvRowsInPlaceFunc
+        deinterlace_yuv_rows_in_place_funcs[NumStrengths] = {
+        deinterlace_yuv_rows_in_place_impl<StrengthMultipliers[0]>,
+        deinterlace_yuv_rows_in_place_impl<StrengthMultipliers[1]>,
+        deinterlace_yuv_rows_in_place_impl<StrengthMultipliers[2]>,
+        deinterlace_yuv_rows_in_place_impl<StrengthMultipliers[3]>,
+        deinterlace_yuv_rows_in_place_impl<StrengthMultipliers[4]>,
+};
+
+// YUV version of deinterlace_rows_in_place(); the blend is applied plane by
+// plane. `rows_above` holds unmodified copies of the Y, U and V rows above
+// first_row (layout.width bytes each; only Y for 4:2:0).
+//
+// A 4:2:0 chroma row covers two luma rows, one from each field, so it has
+// no row of its own to bleed from. Instead, the samples over filled luma
+// pixels get the desaturation of the black row undone (see
+// scale_chroma_420()).
+void deinterlace_yuv_rows_in_place(const MaskLayout& layout,
+                                   const YuvFrameView& frame,
+                                   MaskBuffer& mask, RowOccupancy& occupancy,
+                                   const int first_row, const int last_row,
+                                   const int mask_first_row,
+                                   const uint8_t* rows_above,
+                                   const Strength strength)
+{
+	const TraceSpan span("deinterlace_yuv_rows_in_place");
+
+	deinterlace_yuv_rows_in_place_funcs[static_cast<int>(strength)](
+	        layout,
+	        frame,
+	        mask,
+	        occupancy,
+	        first_row,
+	        last_row,
+	        mask_first_row,
+	        rows_above);
+}
+
+static int find_root(std::vector<int>& parent, int label)
+{
+	while (parent[label] != label) {
+		// Path halving
+		parent[label] = parent[parent[label]];
+		label         = parent[label];
+	}
+	return label;
+}
+
+// Appends the runs of set bits of a mask row to `runs`. Runs crossing word
+// boundaries are merged.
+static void find_row_runs(const MaskLayout& layout, const uint64_t* mask_line,
+                          std::vector<MaskRun>& runs)
+{
+	auto run_open = false;
+
+	for (auto x = 0; x < layout.width / 64; ++x) {
+		auto bits = mask_line[x];
+		auto pos  = 0;
+
+		while (pos < 64) {
+			const auto rest = bits >> pos;
+			if (!rest) {
+				run_open = false;
+				break;
+			}
+			const auto start = pos + std::countr_zero(rest);
+			const auto len   = std::countr_one(bits >> start);
+
+			if (run_open && start == 0) {
+				// Continuation of a run from the previous word
+				runs.back().x1 += len;
+			} else {
+				runs.push_back({x * 64 + start, x * 64 + start + len});
+			}
+
+			pos      = start + len;
+			run_open = (pos == 64);
+		}
+	}
+}
+
+// Finds the bounding rectangles of the 8-connected regions of set bits in the
+// first num_rows rows of a final mask. Rows are scanned top-down as runs of
+// set bits; runs that touch a run of the previous row are joined with
+// union-find, then the bounding boxes of the joined runs are merged. The
+// rects are returned sorted by x, then y.
+void find_mask_rects(const MaskLayout& layout, MaskBuffer& mask,
+                     RowOccupancy& occupancy, const int num_rows,
+                     RectScratch& scratch, std::vector<Rect>& rects)
+{
+	const TraceSpan span("find_mask_rects");
+
+	auto& prev_runs = scratch.prev_runs;
+	auto& curr_runs = scratch.curr_runs;
+	auto& parent    = scratch.parent;
+	auto& bounds    = scratch.bounds;
+
+	prev_runs.clear();
+	parent.clear();
+	bounds.clear();
+
+	auto mask_line = mask.data() + layout.offset + layout.pitch;
+
+	for (auto y = 0; y < num_rows; ++y, mask_line += layout.pitch) {
+		curr_runs.clear();
+
+		if (is_row_occupied(occupancy, y)) {
+			find_row_runs(layout, mask_line, curr_runs);
+		}
+
+		// Both run lists are sorted by x, so the overlapping runs can be
+		// found in a single merge-like pass. Runs also touch diagonally
+		// when one ends right where the other starts.
+		auto p = prev_runs.begin();
+
+		for (auto& run : curr_runs) {
+			run.label = -1;
+
+			while (p != prev_runs.end() && p->x1 < run.x0) {
+				++p;
+			}
+			for (auto q = p; q != prev_runs.end() && q->x0 <= run.x1; ++q) {
+				const auto root = find_root(parent, q->label);
+				if (run.label < 0) {
+					run.label = root;
+				} else {
+					const auto own_root = find_root(parent, run.label);
+					if (own_root != root) {
+						parent[root] = own_root;
+					}
+				}
+			}
+
+			if (run.label < 0) {
+				run.label = (int)parent.size();
+				parent.push_back(run.label);
+				bounds.push_back({run.x0, y, 0, 0});
+			}
+
+			// Bounds are kept as x0/y0/x1/y1 until the end
+			auto& b  = bounds[run.label];
+			b.x      = std::min(b.x, run.x0);
+			b.width  = std::max(b.width, run.x1);
+			b.height = y + 1;
+		}
+
+		std::swap(prev_runs, curr_runs);
+	}
+
+	// Merge the bounds of all joined labels into their roots
+	for (auto label = 0; label < (int)parent.size(); ++label) {
+		const auto root = find_root(parent, label);
+		if (root == label) {
+			continue;
+		}
+		auto& b  = bounds[root];
+		auto& lb = bounds[label];
+		b.x      = std::min(b.x, lb.x);
+		b.y      = std::min(b.y, lb.y);
+		b.width  = std::max(b.width, lb.width);
+		b.height = std::max(b.height, lb.height);
+	}
+
+	rects.clear();
+	for (auto label = 0; label < (int)parent.size(); ++label) {
+		if (parent[label] == label) {
+			const auto& b = bounds[label];
+			rects.push_back({b.x, b.y, b.width - b.x, b.height - b.y});
+		}
+	}
+
+	// Sorted so the order doesn't depend on the labelling
+	std::sort(rects.begin(), rects.end(), [](const Rect& a, const Rect& b) {
+		return (a.x != b.x) ? (a.x < b.x) : (a.y < b.y);
+	});
+}
@@ -0,0 +1,264 @@
+#ifndef FMV_DEINTERLACE_STAGES_H
+#define FMV_DEINTERLACE_STAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string_view>
+#include <vector>
+
+// RGBA pixel data of a frame owned by the caller. The pitch is the number of
+// pixels (uint32_t's) between two consecutive rows.
+struct FrameView {
+	uint32_t* pixels = nullptr;
+
+	int width  = 0;
+	int height = 0;
+	int pitch  = 0;
+};
+
+// 8-bit plane of a planar YUV frame owned by the caller. The pitch is the
+// number of bytes between two consecutive rows.
+struct PlaneView {
+	uint8_t* pixels = nullptr;
+
+	int width  = 0;
+	int height = 0;
+	int pitch  = 0;
+};
+
+enum class ChromaSubsampling { Yuv420, Yuv444 };
+
+// Planar 8-bit YUV frame. The chroma planes are full size for 4:4:4, and
+// half the width and height of the luma plane (rounded up) for 4:2:0.
+struct YuvFrameView {
+	PlaneView y = {};
+	PlaneView u = {};
+	PlaneView v = {};
+
+	ChromaSubsampling subsampling = ChromaSubsampling::Yuv420;
+
+	// Luma samples up to this level count as black (16 for limited range
+	// video, 0 for full range)
+	uint8_t black_level = 16;
+};
+
+// Minimal allocator that aligns the storage of a std::vector to `Alignment`
+// bytes, so the mask buffers start on a cache line
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+	using value_type = T;
+
+	template <typename U>
+	struct rebind {
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() = default;
+
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+	{}
+
+	T* allocate(const size_t n)
+	{
+		return static_cast<T*>(
+		        ::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+	}
+
+	void deallocate(T* p, const size_t)
+	{
+		::operator delete(p, std::align_val_t(Alignment));
+	}
+
+	template <typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const
+	{
+		return true;
+	}
+};
+
+// 1-bit masks, 64 pixels per uint64_t
+using MaskBuffer = std::vector<uint64_t, AlignedAllocator<uint64_t, 64>>;
+
+// Row occupancy summary of a mask buffer. Bit Y % 64 of word Y / 64 is set if
+// mask row Y has any bits set, so a zero word means a whole 64-row block is
+// empty. Stages that know a row is empty can skip it without loading its mask
+// words.
+using RowOccupancy = std::vector<uint64_t>;
+
+// Grows a buffer to at least `size` elements; never shrinks it, so the
+// buffers end up sized for the largest frame seen so far
+template <typename Buffer>
+inline void grow_buffer(Buffer& buffer, const size_t size)
+{
+	if (buffer.size() < size) {
+		buffer.resize(size);
+	}
+}
+
+// Layout of the mask buffers for a given image size
+struct MaskLayout {
+	int width  = 0;
+	int height = 0;
+
+	// Number of uint64_t's between two consecutive rows
+	int pitch = 0;
+
+	// Number of uint64_t's before the start of the actual image data in
+	// each row
+	int offset = 2;
+};
+
+// Frame widths must be a multiple of this. Every stage works on whole mask
+// words of 64 pixels, so the pixels of a partial last word would be left
+// out.
+constexpr auto FrameWidthMultiple = 64;
+
+// We store 64 1-bit pixels per uint64_t, plus `offset` uint64_t's for padding
+// at the start of each row.
+inline MaskLayout make_mask_layout(const int width, const int height)
+{
+	MaskLayout layout = {};
+
+	layout.width  = width;
+	layout.height = height;
+	layout.pitch  = width / 64 + layout.offset;
+
+	return layout;
+}
+
+// Number of uint64_t's in a mask buffer of num_rows rows, including the
+// padding rows at the top and bottom
+inline size_t mask_buffer_size(const MaskLayout& layout, const int num_rows)
+{
+	return (size_t)layout.pitch * (num_rows + 2);
+}
+
+// Deinterlacing strength params
+enum class Strength { Low, Medium, High, Subtle, Full };
+
+constexpr auto NumStrengths = 5;
+
+// Parses a strength name as given on the command line (low, medium, high,
+// subtle or full). Returns false if the name is unknown.
+bool parse_strength(const std::string_view name, Strength& strength);
+
+// Number of layout.width / 64 sized line buffers open_mask() needs
+constexpr auto OpenMaskNumLines = 13;
+
+// Number of extra rows processed above and below a band so its own rows get
+// the same final mask as when processing the whole frame: the XOR step
+// needs one row above, and the two erode and two dilate iterations need
+// four more rows in both directions.
+constexpr auto BandHaloTop    = 1 + 2 + 2;
+constexpr auto BandHaloBottom = 2 + 2;
+
+// A rectangular region of the image, in pixels
+struct Rect {
+	int x      = 0;
+	int y      = 0;
+	int width  = 0;
+	int height = 0;
+};
+
+// Horizontal run of set mask bits in a row (x1 is exclusive)
+struct MaskRun {
+	int x0    = 0;
+	int x1    = 0;
+	int label = 0;
+};
+
+// Reusable working buffers for find_mask_rects()
+struct RectScratch {
+	std::vector<MaskRun> prev_runs = {};
+	std::vector<MaskRun> curr_runs = {};
+	std::vector<int> parent        = {};
+	std::vector<Rect> bounds       = {};
+};
+
+// Instruction sets the accelerated kernels are implemented in
+enum class KernelIsa {
+	// The fastest one the host CPU supports (the default)
+	Auto,
+
+	// Portable C++ reference implementations
+	Scalar,
+
+	Avx2,
+	Avx512
+};
+
+// Switches all kernels to the given instruction set. Returns false and
+// leaves the kernels alone if the host CPU doesn't support it. Meant for
+// testing the kernel variants against each other; must not be called while
+// any frames are being processed.
+bool set_kernel_isa(const KernelIsa isa);
+
+// Individual (unfused) stages, mainly for writing the intermediate passes
+void threshold(const MaskLayout& layout, const FrameView& src,
+               MaskBuffer& dest);
+
+void downshift_and_xor(const MaskLayout& layout, MaskBuffer& src,
+                       MaskBuffer& dest);
+
+void erode_horiz(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest);
+void erode_vert(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest);
+void dilate_horiz(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest);
+void dilate_vert(const MaskLayout& layout, MaskBuffer& src, MaskBuffer& dest);
+
+void find_occupied_rows(const MaskLayout& layout, MaskBuffer& mask,
+                        RowOccupancy& occupancy, const int num_rows);
+
+// Fused stages
+void threshold_and_xor(const MaskLayout& layout, const FrameView& src,
+                       MaskBuffer& dest, RowOccupancy& dest_occupancy,
+                       MaskBuffer& prev_line, const int first_row,
+                       const int num_rows);
+
+void threshold_luma_and_xor(const MaskLayout& layout, const PlaneView& luma,
+                            const uint8_t black_level, MaskBuffer& dest,
+                            RowOccupancy& dest_occupancy,
+                            MaskBuffer& prev_line, const int first_row,
+                            const int num_rows);
+
+void open_mask(const MaskLayout& layout, MaskBuffer& src,
+               RowOccupancy& src_occupancy, MaskBuffer& dest,
+               RowOccupancy& dest_occupancy,
+               MaskBuffer& line_buffers, const int num_rows);
+
+// Blending
+void deinterlace_rows(const MaskLayout& layout, const FrameView& src,
+                      MaskBuffer& mask, RowOccupancy& occupancy,
+                      const FrameView& dest,
+                      const int first_row, const int last_row,
+                      const int mask_first_row, const Strength strength);
+
+void deinterlace(const MaskLayout& layout, const FrameView& src,
+                 MaskBuffer& mask, RowOccupancy& occupancy,
+                 const FrameView& dest, const Strength strength);
+
+void deinterlace_rows_in_place(const MaskLayout& layout, const FrameView& frame,
+                               MaskBuffer& mask,
+                               RowOccupancy& occupancy, const int first_row,
+                               const int last_row, const int mask_first_row,
+                               const uint32_t* row_above,
+                               const Strength strength);
+
+void deinterlace_in_place(const MaskLayout& layout, const FrameView& frame,
+                          MaskBuffer& mask, RowOccupancy& occupancy,
+                          const Strength strength);
+
+void deinterlace_yuv_rows_in_place(const MaskLayout& layout,
+                                   const YuvFrameView& frame,
+                                   MaskBuffer& mask, RowOccupancy& occupancy,
+                                   const int first_row, const int last_row,
+                                   const int mask_first_row,
+                                   const uint8_t* rows_above,
+                                   const Strength strength);
+
+void find_mask_rects(const MaskLayout& layout, MaskBuffer& mask,
+                     RowOccupancy& occupancy, const int num_rows,
+                     RectScratch& scratch, std::vector<Rect>& rects);
+
+#endif // FMV_DEINTERLACE_STAGES_H
@@ -0,0 +1,235 @@
+#include "synthetic.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "stages.h"
+
+// Small deterministic PRNG (SplitMix64). The distributions of <random> are
+// implementation defined, so they'd give different frames with different
+// standard libraries.
+class Random {
+public:
+	explicit Random(const uint64_t seed) : state(seed) {}
+
+	uint32_t next()
+	{
+		state += 0x9e3779b97f4a7c15;
+
+		auto z = state;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+		return (uint32_t)((z ^ (z >> 31)) >> 32);
+	}
+
+	// Uniform in [0, n)
+	int below(const int n)
+	{
+		return (n > 0) ? (int)(next() % (uint32_t)n) : 0;
+	}
+
+	// Uniform in [lo, hi]
+	int between(const int lo, const int hi)
+	{
+		return lo + below(hi - lo + 1);
+	}
+
+private:
+	uint64_t state = 0;
+};
+
+static constexpr uint32_t rgba(const int r, const int g, const int b)
+{
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) |
+	       0xff000000;
+}
+
+// Opaque, like the pixels of a loaded image
+constexpr auto Black = rgba(0, 0, 0);
+
+struct Canvas {
+	std::vector<uint32_t>& pixels;
+
+	int width  = 0;
+	int height = 0;
+
+	// Clipped to the frame
+	void fill_rect(int x0, int y0, int x1, int y1, const uint32_t color)
+	{
+		x0 = std::clamp(x0, 0, width);
+		x1 = std::clamp(x1, 0, width);
+		y0 = std::clamp(y0, 0, height);
+		y1 = std::clamp(y1, 0, height);
+
+		for (auto y = y0; y < y1; ++y) {
+			std::fill(pixels.begin() + (size_t)y * width + x0,
+			          pixels.begin() + (size_t)y * width + x1,
+			          color);
+		}
+	}
+
+	void outline_rect(const int x0, const int y0, const int x1,
+	                  const int y1, const int thickness,
+	                  const uint32_t color)
+	{
+		fill_rect(x0, y0, x1, y0 + thickness, color);
+		fill_rect(x0, y1 - thickness, x1, y1, color);
+		fill_rect(x0, y0, x0 + thickness, y1, color);
+		fill_rect(x1 - thickness, y0, x1, y1, color);
+	}
+};
+
+// Window border, a status bar with a line of "text" (random 5x7 glyphs with
+// a few whole-pixel strokes, like a bitmap font), and some buttons
+static void draw_static_ui(Canvas& canvas, Random& random)
+{
+	const auto w = canvas.width;
+	const auto h = canvas.height;
+
+	constexpr auto BorderColor = rgba(96, 96, 112);
+	constexpr auto PanelColor  = rgba(48, 48, 64);
+	constexpr auto TextColor   = rgba(220, 220, 180);
+
+	canvas.outline_rect(0, 0, w, h, 4, BorderColor);
+
+	const auto bar_top = h - 28;
+	canvas.fill_rect(4, bar_top, w - 4, h - 4, PanelColor);
+
+	constexpr auto GlyphWidth  = 5;
+	constexpr auto GlyphHeight = 7;
+
+	for (auto x = 12; x + GlyphWidth < w - 12; x += GlyphWidth + 2) {
+		// Word gaps
+		if (random.below(6) == 0) {
+			continue;
+		}
+		const auto glyph_top = bar_top + 8;
+
+		for (auto stroke = 0; stroke < 3; ++stroke) {
+			if (random.below(2) == 0) {
+				const auto gx = x + random.below(GlyphWidth);
+				canvas.fill_rect(gx,
+				                 glyph_top,
+				                 gx + 1,
+				                 glyph_top + GlyphHeight,
+				                 TextColor);
+			} else {
+				const auto gy = glyph_top + random.below(GlyphHeight);
+				canvas.fill_rect(x, gy, x + GlyphWidth, gy + 1, TextColor);
+			}
+		}
+	}
+
+	const auto num_buttons = random.between(2, 5);
+
+	for (auto i = 0; i < num_buttons; ++i) {
+		const auto bw = random.between(40, 96);
+		const auto bh = random.between(16, 28);
+		const auto bx = random.between(8, std::max(w - bw - 8, 8));
+		const auto by = random.between(8, std::max(bar_top - bh - 8, 8));
+
+		canvas.fill_rect(bx, by, bx + bw, by + bh, PanelColor);
+		canvas.outline_rect(bx, by, bx + bw, by + bh, 1, BorderColor);
+	}
+}
+
+// Interlaced video: every other line is black, and the video lines are made
+// of runs of non-black pixels separated by black runs (dark areas of the
+// video) in the ratio given by the density
+static void draw_fmv_rect(Canvas& canvas, Random& random, const int x0,
+                          const int y0, const int x1, const int y1,
+                          const float density)
+{
+	constexpr auto MeanRunPairLength = 32.0f;
+
+	const auto mean_lit  = MeanRunPairLength * density;
+	const auto mean_dark = MeanRunPairLength - mean_lit;
+
+	// Run lengths from 1 to twice the mean, or none at all
+	auto run_length = [&](const float mean) {
+		const auto max_length = (int)std::lround(mean * 2);
+		return (max_length > 0) ? random.between(1, max_length) : 0;
+	};
+
+	// Gradient with noise; never black
+	auto noisy = [&](const int base) {
+		return std::clamp(base + random.below(32) - 16, 8, 255);
+	};
+
+	const auto rect_width  = std::max(x1 - x0, 1);
+	const auto rect_height = std::max(y1 - y0, 1);
+
+	canvas.fill_rect(x0, y0, x1, y1, Black);
+
+	for (auto y = y0; y < y1; y += 2) {
+		auto row = canvas.pixels.data() + (size_t)y * canvas.width;
+
+		auto x = x0;
+		while (x < x1) {
+			const auto lit_end = std::min(x + run_length(mean_lit), x1);
+
+			for (; x < lit_end; ++x) {
+				const auto r = noisy((x - x0) * 255 / rect_width);
+				const auto g = noisy((y - y0) * 255 / rect_height);
+				const auto b = noisy(128);
+
+				row[x] = rgba(r, g, b);
+			}
+			x = std::min(x + run_length(mean_dark), x1);
+		}
+	}
+}
+
+void generate_synthetic_frame(const SyntheticFrameParams& params,
+                              std::vector<uint32_t>& pixels)
+{
+	assert(params.width % FrameWidthMultiple == 0);
+
+	const auto width  = params.width;
+	const auto height = params.height;
+
+	pixels.assign((size_t)width * height, Black);
+
+	Canvas canvas = {pixels, width, height};
+	Random random(params.seed);
+
+	if (params.static_ui) {
+		draw_static_ui(canvas, random);
+	}
+
+	const auto num_rects = std::max(params.num_fmv_rects, 0);
+	if (num_rects == 0) {
+		return;
+	}
+
+	const auto coverage = std::clamp(params.fmv_coverage, 0.0f, 1.0f);
+	const auto density  = std::clamp(params.fmv_density, 0.0f, 1.0f);
+
+	// 4:3 rectangles of equal area
+	const auto rect_area = coverage * (float)width * (float)height /
+	                       (float)num_rects;
+
+	const auto rect_width = std::min(
+	        (int)std::lround(std::sqrt(rect_area * 4 / 3)), width);
+
+	if (rect_width == 0) {
+		return;
+	}
+	const auto rect_height = std::min(
+	        (int)std::lround(rect_area / (float)rect_width), height);
+
+	for (auto i = 0; i < num_rects; ++i) {
+		const auto x = random.between(0, width - rect_width);
+		const auto y = random.between(0, height - rect_height);
+
+		draw_fmv_rect(canvas,
+		              random,
+		              x,
+		              y,
+		              x + rect_width,
+		              y + rect_height,
+		              density);
+	}
+}
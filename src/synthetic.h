@@ -0,0 +1,39 @@
+#ifndef FMV_DEINTERLACE_SYNTHETIC_H
+#define FMV_DEINTERLACE_SYNTHETIC_H
+
+#include <cstdint>
+#include <vector>
+
+// Parameters of a synthetic test frame
+struct SyntheticFrameParams {
+	int width  = 640;
+	int height = 480;
+
+	// The same seed and parameters always give the same frame, on any
+	// platform
+	uint32_t seed = 1;
+
+	// Static, non-interlaced UI elements (window borders, buttons, text)
+	// around the FMV areas, like in the game screens the FMV plays in
+	bool static_ui = true;
+
+	// Number of interlaced FMV rectangles, and the fraction of the frame
+	// they cover in total (0 to 1). They're placed randomly and may
+	// overlap.
+	int num_fmv_rects   = 1;
+	float fmv_coverage  = 0.25f;
+
+	// Fraction of the pixels of the video lines that are not black (0 to
+	// 1). Low values give sparse masks with lots of small runs, high ones
+	// dense masks with long runs.
+	float fmv_density = 0.9f;
+};
+
+// Generates an RGBA frame that looks like a typical game screen with FMV
+// playing in it: black background, static UI, and interlaced video
+// rectangles where every other line is black. The width must be a multiple
+// of 64.
+void generate_synthetic_frame(const SyntheticFrameParams& params,
+                              std::vector<uint32_t>& pixels);
+
+#endif // FMV_DEINTERLACE_SYNTHETIC_H
@@ -0,0 +1,239 @@
+#include "temporal_mask.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Rebuilds the final mask rows first_row to last_row - 1, words first_word to
+// last_word - 1, from a window of the input that also includes the band
+// halos and one word on both sides for the horizontal morphology
+template <typename ThresholdWindow>
+void TemporalMask::recompute_window(const int first_row, const int last_row,
+                                    const int first_word, const int last_word,
+                                    ThresholdWindow& threshold_window)
+{
+	const auto window_first_row = std::max(first_row - BandHaloTop, 0);
+	const auto window_last_row = std::min(last_row + BandHaloBottom,
+	                                      layout.height);
+	const auto window_first_word = std::max(first_word - 1, 0);
+	const auto window_last_word  = std::min(last_word + 1, layout.width / 64);
+
+	const auto num_rows = window_last_row - window_first_row;
+
+	const auto window_layout = make_mask_layout(
+	        (window_last_word - window_first_word) * 64, num_rows);
+
+	threshold_window(window_layout,
+	                 window_first_word,
+	                 window_first_row,
+	                 num_rows);
+
+	open_mask(window_layout,
+	          window_mask,
+	          window_occupancy,
+	          window_mask,
+	          window_occupancy,
+	          open_lines,
+	          num_rows);
+
+	const auto num_words = last_word - first_word;
+
+	for (auto y = first_row; y < last_row; ++y) {
+		const auto in = window_mask.data() + window_layout.offset +
+		                window_layout.pitch * (y - window_first_row + 1) +
+		                (first_word - window_first_word);
+
+		const auto out = full_mask.data() + layout.offset +
+		                 layout.pitch * (y + 1) + first_word;
+
+		std::copy_n(in, num_words, out);
+	}
+}
+
+void TemporalMask::update(const MaskLayout& _layout, const FrameView& frame)
+{
+	const InputPlane input = {reinterpret_cast<const uint8_t*>(frame.pixels),
+	                          frame.pitch * (int)sizeof(uint32_t),
+	                          (int)sizeof(uint32_t)};
+
+	auto threshold_window = [&](const MaskLayout& window_layout,
+	                            const int first_word,
+	                            const int first_row,
+	                            const int num_rows) {
+		FrameView window = frame;
+		window.pixels += first_word * 64;
+		window.width = window_layout.width;
+
+		threshold_and_xor(window_layout,
+		                  window,
+		                  window_mask,
+		                  window_occupancy,
+		                  prev_line,
+		                  first_row,
+		                  num_rows);
+	};
+
+	update_impl(_layout, input, Source::Rgba, 0, threshold_window);
+}
+
+void TemporalMask::update(const MaskLayout& _layout, const PlaneView& luma,
+                          const uint8_t _black_level)
+{
+	const InputPlane input = {luma.pixels, luma.pitch, 1};
+
+	auto threshold_window = [&](const MaskLayout& window_layout,
+	                            const int first_word,
+	                            const int first_row,
+	                            const int num_rows) {
+		PlaneView window = luma;
+		window.pixels += first_word * 64;
+		window.width = window_layout.width;
+
+		threshold_luma_and_xor(window_layout,
+		                       window,
+		                       _black_level,
+		                       window_mask,
+		                       window_occupancy,
+		                       prev_line,
+		                       first_row,
+		                       num_rows);
+	};
+
+	update_impl(_layout, input, Source::Luma, _black_level, threshold_window);
+}
+
+template <typename ThresholdWindow>
+void TemporalMask::update_impl(const MaskLayout& _layout,
+                               const InputPlane& input, const Source _source,
+                               const uint8_t _black_level,
+                               ThresholdWindow threshold_window)
+{
+	// A different source or black level makes a different mask from the
+	// same pixels
+	if (_layout.width != layout.width || _layout.height != layout.height ||
+	    _source != source || _black_level != black_level) {
+		resize(_layout, input.bytes_per_pixel);
+		valid = false;
+	}
+	source      = _source;
+	black_level = _black_level;
+
+	if (!find_changed_tiles(input)) {
+		return;
+	}
+
+	// An input row R affects the final mask rows R - BandHaloBottom to
+	// R + BandHaloTop, and an input pixel the mask bits 4 pixels to its
+	// left and right, which can be in the neighbouring mask words.
+	// Consecutive rows of tiles with changes are recomputed in a single
+	// window spanning all their changed columns.
+	const auto num_tile_rows = (int)changed_spans.size();
+
+	auto tile_row = 0;
+	while (tile_row < num_tile_rows) {
+		if (changed_spans[tile_row].first > changed_spans[tile_row].last) {
+			++tile_row;
+			continue;
+		}
+		auto first_tile = changed_spans[tile_row].first;
+		auto last_tile  = changed_spans[tile_row].last;
+
+		auto end_tile_row = tile_row + 1;
+		while (end_tile_row < num_tile_rows &&
+		       changed_spans[end_tile_row].first <=
+		               changed_spans[end_tile_row].last) {
+			first_tile = std::min(first_tile, changed_spans[end_tile_row].first);
+			last_tile = std::max(last_tile, changed_spans[end_tile_row].last);
+			++end_tile_row;
+		}
+
+		const auto first_input_row = tile_row * TileHeight;
+		const auto last_input_row = std::min(end_tile_row * TileHeight,
+		                                     layout.height);
+
+		recompute_window(std::max(first_input_row - BandHaloBottom, 0),
+		                 std::min(last_input_row + BandHaloTop, layout.height),
+		                 std::max(first_tile - 1, 0),
+		                 std::min(last_tile + 2, layout.width / 64),
+		                 threshold_window);
+
+		tile_row = end_tile_row;
+	}
+
+	find_occupied_rows(layout, full_mask, full_occupancy, layout.height);
+
+	valid = true;
+}
+
+void TemporalMask::resize(const MaskLayout& _layout, const int bytes_per_pixel)
+{
+	layout = _layout;
+
+	const auto num_words = (size_t)layout.width / 64;
+	const auto height    = layout.height;
+
+	// Windows never need more room than the whole frame
+	grow_buffer(full_mask, mask_buffer_size(layout, height));
+	grow_buffer(full_occupancy, (size_t)(height + 63) / 64);
+	grow_buffer(window_mask, mask_buffer_size(layout, height));
+	grow_buffer(window_occupancy, (size_t)(height + 63) / 64);
+	grow_buffer(prev_line, num_words);
+	grow_buffer(open_lines, OpenMaskNumLines * num_words);
+
+	// Only the pixels covered by the mask words are kept
+	prev_input_pitch = (int)num_words * TileWidth * bytes_per_pixel;
+	grow_buffer(prev_input, (size_t)prev_input_pitch * height);
+
+	grow_buffer(changed_spans, (size_t)(height + TileHeight - 1) / TileHeight);
+}
+
+// Compares every tile with the previous frame, and copies the changed ones
+// over it. Returns false if nothing changed.
+bool TemporalMask::find_changed_tiles(const InputPlane& input)
+{
+	const auto num_tile_cols = layout.width / TileWidth;
+	const auto num_tile_rows = (layout.height + TileHeight - 1) / TileHeight;
+	const auto tile_bytes    = TileWidth * input.bytes_per_pixel;
+
+	changed_spans.resize(num_tile_rows);
+	changed_tiles = 0;
+
+	for (auto ty = 0; ty < num_tile_rows; ++ty) {
+		const auto first_row = ty * TileHeight;
+		const auto last_row = std::min(first_row + TileHeight, layout.height);
+
+		auto& span = changed_spans[ty];
+		span = {num_tile_cols, -1};
+
+		for (auto tx = 0; tx < num_tile_cols; ++tx) {
+			const auto in = input.pixels + first_row * input.pitch +
+			                tx * tile_bytes;
+			const auto prev = prev_input.data() +
+			                  first_row * prev_input_pitch + tx * tile_bytes;
+
+			auto y = first_row;
+			if (valid) {
+				while (y < last_row &&
+				       std::memcmp(in + (y - first_row) * input.pitch,
+				                   prev + (y - first_row) * prev_input_pitch,
+				                   tile_bytes) == 0) {
+					++y;
+				}
+				if (y == last_row) {
+					continue;
+				}
+			}
+
+			// Rows above `y` are known to be the same
+			for (; y < last_row; ++y) {
+				std::memcpy(prev + (y - first_row) * prev_input_pitch,
+				            in + (y - first_row) * input.pitch,
+				            tile_bytes);
+			}
+
+			span.first = std::min(span.first, tx);
+			span.last  = tx;
+			++changed_tiles;
+		}
+	}
+	return changed_tiles > 0;
+}
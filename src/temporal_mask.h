@@ -0,0 +1,109 @@
+#ifndef FMV_DEINTERLACE_TEMPORAL_MASK_H
+#define FMV_DEINTERLACE_TEMPORAL_MASK_H
+
+#include <cstdint>
+#include <vector>
+
+#include "stages.h"
+
+// Final mask of a stream of frames that's only recomputed where the input
+// changed. FMV windows tend to stay in the same place for hundreds of
+// frames, so most of the mask work can be skipped.
+//
+// The frame is split into TileWidth x TileHeight tiles, and each tile is
+// compared with the same tile of the previous frame. The mask is then
+// rebuilt with the fused stages in windows around the changed tiles; the
+// windows include the rows and columns the changed pixels can affect, plus
+// the band halos, so the result is identical to processing the whole frame.
+class TemporalMask {
+public:
+	// One mask word wide
+	static constexpr auto TileWidth  = 64;
+	static constexpr auto TileHeight = 16;
+
+	// Updates the mask for a new RGBA frame
+	void update(const MaskLayout& layout, const FrameView& frame);
+
+	// Updates the mask for a new frame from its luma plane
+	void update(const MaskLayout& layout, const PlaneView& luma,
+	            const uint8_t black_level);
+
+	// Forces a full recompute on the next update
+	void invalidate()
+	{
+		valid = false;
+	}
+
+	MaskBuffer& mask()
+	{
+		return full_mask;
+	}
+
+	RowOccupancy& occupancy()
+	{
+		return full_occupancy;
+	}
+
+	// Number of tiles that changed in the last update
+	int num_changed_tiles() const
+	{
+		return changed_tiles;
+	}
+
+private:
+	// Input of the mask stages, or the part of it the stages look at
+	struct InputPlane {
+		const uint8_t* pixels = nullptr;
+
+		// In bytes
+		int pitch           = 0;
+		int bytes_per_pixel = 0;
+	};
+
+	// Column span of the changed tiles in a row of tiles (`first` > `last`
+	// if there are none)
+	struct TileSpan {
+		int first = 0;
+		int last  = 0;
+	};
+
+	enum class Source { Rgba, Luma };
+
+	template <typename ThresholdWindow>
+	void update_impl(const MaskLayout& layout, const InputPlane& input,
+	                 const Source source, const uint8_t black_level,
+	                 ThresholdWindow threshold_window);
+
+	void resize(const MaskLayout& layout, const int bytes_per_pixel);
+
+	bool find_changed_tiles(const InputPlane& input);
+
+	template <typename ThresholdWindow>
+	void recompute_window(const int first_row, const int last_row,
+	                      const int first_word, const int last_word,
+	                      ThresholdWindow& threshold_window);
+
+	MaskLayout layout = {};
+
+	MaskBuffer full_mask          = {};
+	RowOccupancy full_occupancy   = {};
+
+	// Working buffers of a recompute window
+	MaskBuffer window_mask          = {};
+	RowOccupancy window_occupancy   = {};
+	MaskBuffer prev_line            = {};
+	MaskBuffer open_lines           = {};
+
+	// Mask-relevant part of the previous input frame, packed
+	std::vector<uint8_t> prev_input = {};
+	int prev_input_pitch            = 0;
+
+	std::vector<TileSpan> changed_spans = {};
+	int changed_tiles                   = 0;
+
+	bool valid          = false;
+	Source source       = Source::Rgba;
+	uint8_t black_level = 0;
+};
+
+#endif // FMV_DEINTERLACE_TEMPORAL_MASK_H
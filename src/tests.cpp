@@ -0,0 +1,1243 @@
+// Regression tests of the deinterlacing pipeline:
+//
+// - Golden hashes of the intermediate masks, the FMV regions and the final
+//   RGBA output of every strength on the sample images. All the other ways
+//   of running the pipeline (fused stages, in place, in bands, with reused
+//   masks) must give the same results as the individual stages.
+//
+// - Every accelerated kernel variant the host CPU supports is checked bit
+//   for bit against the scalar reference on random inputs.
+//
+// - The YUV pipeline with a reused mask against a full recompute, the 4:2:0
+//   chroma blend, and a round trip through the Y4M writer and reader.
+//
+// - The frame size checks of the Deinterlacer, the frame cache on a forced
+//   hash collision, and the output file name clash check of the batch and
+//   sequence modes.
+//
+// Usage: deinterlace_tests IMAGES_DIR [--print-hashes]
+//
+// --print-hashes prints the hashes of the current code in the format of the
+// GoldenImages table, for updating it after an intentional change of the
+// output.
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "deinterlacer.h"
+#include "frame_cache.h"
+#include "image_io.h"
+#include "stages.h"
+#include "synthetic.h"
+#include "y4m.h"
+
+static int num_failures = 0;
+
+static void fail(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+
+	printf("FAIL: ");
+	vprintf(format, args);
+	printf("\n");
+
+	va_end(args);
+	++num_failures;
+}
+
+constexpr const char* StrengthNames[NumStrengths] = {
+        "low", "medium", "high", "subtle", "full"};
+
+// Hashes of the results of the stages on an image
+struct ImageHashes {
+	// Masks after the individual stages
+	uint64_t threshold         = 0;
+	uint64_t downshift_and_xor = 0;
+	uint64_t erode             = 0;
+	uint64_t dilate            = 0;
+
+	// find_mask_rects()
+	uint64_t rects = 0;
+
+	// deinterlace(), indexed by Strength
+	uint64_t output[NumStrengths] = {};
+};
+
+struct GoldenImage {
+	const char* filename = nullptr;
+	ImageHashes hashes   = {};
+};
+
+// clang-format off
+static const GoldenImage GoldenImages[] = {
+        {"angel1.png",
+         {0x4c885c563174e903, 0xbc4bbc2caf8c3353,
+          0xdf7cbeb37540f0ed, 0x5b1d5243bc00832a,
+          0x38c0ae1482ba44aa,
+          {0x5d3567743c9cf46f, 0xf405f8a7838de9bf, 0x517bc3e4e4b828a2,
+           0x74b43da2bf4b5ba5, 0xb51454cd3fe255e0}}},
+        {"angel2.png",
+         {0x4c885c563174e903, 0xbc4bbc2caf8c3353,
+          0xdf7cbeb37540f0ed, 0x5b1d5243bc00832a,
+          0x38c0ae1482ba44aa,
+          {0x9390b59cd4322446, 0x4c3779e1a79159dd, 0xc8ce5cf38a130a80,
+           0xac3bf3756a954393, 0x746b2427af3ebfc0}}},
+        {"angel3.png",
+         {0x940308a7d2d92eb8, 0xb93cf35853808bec,
+          0xd780a1fe8d3808b2, 0x5d61166fd0fab2fa,
+          0x38c0ae1482ba44aa,
+          {0x2643f924da1d596b, 0xa1e7f5ab9bb77f74, 0x89e998af6da5f80f,
+           0xa12ab72612ca1247, 0x52e70d7a45b7c478}}},
+        {"angel4.png",
+         {0x69a654a501eb21e2, 0x972a8ca11a3eb86e,
+          0xa456a7e6494083c7, 0x972a8ca11a3eb86e,
+          0xb59b3dcbf17a3d7c,
+          {0x5f885ac02f0bbfda, 0x66f37d4eeee0afa9, 0xa4e1d5d9c922d5c6,
+           0xabddd0cf614ef6ed, 0xaf3220131dcfc9b3}}},
+        {"angel5.png",
+         {0xc44befa5bba9f1a2, 0x112a43117769bc84,
+          0x2f2c45834bcd3cc1, 0xc2da0cd38d6cae5c,
+          0x38c0ae1482ba44aa,
+          {0x0f7d9c28c859d35e, 0x58510bea5b43096a, 0x3ff411f7371a2a27,
+           0xd9110f5cf751a93e, 0xe933b22e8d904817}}},
+        {"angel6.png",
+         {0x69a654a501eb21e2, 0x972a8ca11a3eb86e,
+          0xa456a7e6494083c7, 0x972a8ca11a3eb86e,
+          0xb59b3dcbf17a3d7c,
+          {0xb5e803c2924b0dc0, 0x156c6d5a0f8b045f, 0xce8d64ad0e6d1666,
+           0x410909b20c7e224e, 0xaa9e14ab8ccde5d9}}},
+        {"phant1.png",
+         {0x3894ac51756e9b3c, 0x345a55bd2618577d,
+          0x2e867cc7d065af99, 0x345a55bd2618577d,
+          0xda51adc1a2211fa0,
+          {0x992c0575fdcbb5ef, 0xdd2dc0d73154e091, 0x8592edada9b813a9,
+           0x71135687e1364e02, 0x00d8d91211cc19fb}}},
+        {"phant2.png",
+         {0x62bc18f3008986ec, 0x2ee1c4835f62836f,
+          0x2e867cc7d065af99, 0x345a55bd2618577d,
+          0xda51adc1a2211fa0,
+          {0x8c051664ccd743de, 0xba294341a0a3f63a, 0xed2f9301b27e7ddc,
+           0x6b8de4d9d7a8aeb6, 0xe1d39842272d71f1}}},
+};
+// clang-format on
+
+template <typename Container>
+static void append_bytes(std::vector<uint8_t>& bytes, const Container& c)
+{
+	const auto data = reinterpret_cast<const uint8_t*>(c.data());
+	bytes.insert(bytes.end(), data, data + c.size() * sizeof(*c.data()));
+}
+
+template <typename Container>
+static uint64_t hash_container(const Container& c)
+{
+	std::vector<uint8_t> bytes;
+	append_bytes(bytes, c);
+
+	return hash_bytes(bytes.data(), bytes.size());
+}
+
+// Only the image bits; the contents of the padding are not part of the
+// result of a stage
+static uint64_t hash_mask(const MaskLayout& layout, const MaskBuffer& mask)
+{
+	std::vector<uint64_t> words;
+
+	for (auto y = 0; y < layout.height; ++y) {
+		const auto row = mask.data() + layout.offset +
+		                 layout.pitch * (y + 1);
+
+		words.insert(words.end(), row, row + layout.width / 64);
+	}
+	return hash_container(words);
+}
+
+// Mask and occupancy buffers of a whole frame
+struct FrameMask {
+	MaskBuffer mask        = {};
+	RowOccupancy occupancy = {};
+
+	explicit FrameMask(const MaskLayout& layout)
+	        : mask(mask_buffer_size(layout, layout.height), 0),
+	          occupancy((layout.height + 63) / 64, 0)
+	{}
+
+	std::vector<uint8_t> bytes() const
+	{
+		std::vector<uint8_t> bytes;
+
+		append_bytes(bytes, mask);
+		append_bytes(bytes, occupancy);
+		return bytes;
+	}
+};
+
+static FrameView frame_view(std::vector<uint32_t>& pixels, const int width,
+                            const int height)
+{
+	return {pixels.data(), width, height, width};
+}
+
+// Runs the individual stages the way `deinterlace INPUT` does when writing
+// the intermediate passes
+static ImageHashes compute_image_hashes(const FrameView& frame)
+{
+	const auto layout  = make_mask_layout(frame.width, frame.height);
+	const auto bufsize = mask_buffer_size(layout, layout.height);
+
+	MaskBuffer buffer1(bufsize, 0);
+	MaskBuffer buffer2(bufsize, 0);
+	MaskBuffer buffer3(bufsize, 0);
+
+	ImageHashes hashes = {};
+
+	threshold(layout, frame, buffer1);
+	hashes.threshold = hash_mask(layout, buffer1);
+
+	downshift_and_xor(layout, buffer1, buffer2);
+	hashes.downshift_and_xor = hash_mask(layout, buffer2);
+
+	for (auto i = 0; i < 2; ++i) {
+		erode_horiz(layout, buffer2, buffer3);
+		erode_vert(layout, buffer3, buffer2);
+	}
+	hashes.erode = hash_mask(layout, buffer2);
+
+	for (auto i = 0; i < 2; ++i) {
+		dilate_horiz(layout, buffer2, buffer3);
+		dilate_vert(layout, buffer3, buffer2);
+	}
+	hashes.dilate = hash_mask(layout, buffer2);
+
+	RowOccupancy occupancy((layout.height + 63) / 64);
+	find_occupied_rows(layout, buffer2, occupancy, layout.height);
+
+	std::vector<uint32_t> output((size_t)frame.width * frame.height);
+	const auto dest = frame_view(output, frame.width, frame.height);
+
+	for (auto i = 0; i < NumStrengths; ++i) {
+		deinterlace(layout, frame, buffer2, occupancy, dest, (Strength)i);
+		hashes.output[i] = hash_container(output);
+	}
+
+	RectScratch scratch = {};
+	std::vector<Rect> rects;
+
+	find_mask_rects(layout, buffer2, occupancy, layout.height, scratch, rects);
+	hashes.rects = hash_container(rects);
+
+	return hashes;
+}
+
+static void check_hash(const std::string& image, const std::string& what,
+                       const uint64_t actual, const uint64_t expected)
+{
+	if (actual != expected) {
+		fail("%s: %s hash is %016llx, expected %016llx",
+		     image.c_str(),
+		     what.c_str(),
+		     (unsigned long long)actual,
+		     (unsigned long long)expected);
+	}
+}
+
+static void check_golden_hashes(const std::string& image,
+                                const ImageHashes& actual,
+                                const ImageHashes& expected)
+{
+	check_hash(image, "threshold", actual.threshold, expected.threshold);
+
+	check_hash(image,
+	           "downshift_and_xor",
+	           actual.downshift_and_xor,
+	           expected.downshift_and_xor);
+
+	check_hash(image, "erode", actual.erode, expected.erode);
+	check_hash(image, "dilate", actual.dilate, expected.dilate);
+	check_hash(image, "rects", actual.rects, expected.rects);
+
+	for (auto i = 0; i < NumStrengths; ++i) {
+		check_hash(image,
+		           std::string(StrengthNames[i]) + " output",
+		           actual.output[i],
+		           expected.output[i]);
+	}
+}
+
+static void print_golden_hashes(const char* filename, const ImageHashes& h)
+{
+	auto hex = [](const uint64_t hash) { return (unsigned long long)hash; };
+
+	printf("        {\"%s\",\n", filename);
+
+	printf("         {0x%016llx, 0x%016llx,\n"
+	       "          0x%016llx, 0x%016llx,\n",
+	       hex(h.threshold),
+	       hex(h.downshift_and_xor),
+	       hex(h.erode),
+	       hex(h.dilate));
+
+	printf("          0x%016llx,\n", hex(h.rects));
+
+	printf("          {0x%016llx, 0x%016llx, 0x%016llx,\n"
+	       "           0x%016llx, 0x%016llx}}},\n",
+	       hex(h.output[0]),
+	       hex(h.output[1]),
+	       hex(h.output[2]),
+	       hex(h.output[3]),
+	       hex(h.output[4]));
+}
+
+// The fused stages, the in-place blend and the Deinterlacer in all its modes
+// must give the same results as the individual stages. `reuse_deinterlacer`
+// is shared by all images, so its mask is updated from the previous image.
+static void check_pipeline_variants(const std::string& image,
+                                    const FrameView& frame,
+                                    const ImageHashes& hashes,
+                                    Deinterlacer& reuse_deinterlacer)
+{
+	const auto width  = frame.width;
+	const auto height = frame.height;
+	const auto layout = make_mask_layout(width, height);
+
+	FrameMask fused(layout);
+
+	MaskBuffer prev_line(width / 64);
+	MaskBuffer open_lines(OpenMaskNumLines * width / 64);
+
+	threshold_and_xor(layout,
+	                  frame,
+	                  fused.mask,
+	                  fused.occupancy,
+	                  prev_line,
+	                  0,
+	                  height);
+
+	open_mask(layout,
+	          fused.mask,
+	          fused.occupancy,
+	          fused.mask,
+	          fused.occupancy,
+	          open_lines,
+	          height);
+
+	check_hash(image,
+	           "fused mask",
+	           hash_mask(layout, fused.mask),
+	           hashes.dilate);
+
+	const std::vector<uint32_t> input(frame.pixels,
+	                                  frame.pixels + (size_t)width * height);
+
+	std::vector<uint32_t> pixels(input.size());
+	const auto view = frame_view(pixels, width, height);
+
+	for (auto i = 0; i < NumStrengths; ++i) {
+		const auto strength = (Strength)i;
+
+		auto check_output = [&](const std::string& mode) {
+			check_hash(image,
+			           std::string(StrengthNames[i]) + " output (" + mode + ")",
+			           hash_container(pixels),
+			           hashes.output[i]);
+		};
+
+		pixels = input;
+		deinterlace_in_place(layout,
+		                     view,
+		                     fused.mask,
+		                     fused.occupancy,
+		                     strength);
+
+		check_output("in place");
+
+		for (const auto num_threads : {1, 3}) {
+			const auto bands = std::to_string(num_threads) + " bands";
+
+			Deinterlacer deinterlacer(width, height);
+
+			deinterlacer.set_strength(strength);
+			deinterlacer.set_num_threads(num_threads);
+
+			deinterlacer.process(frame, view);
+			check_output(bands);
+
+			pixels = input;
+			deinterlacer.process_in_place(view);
+			check_output(bands + ", in place");
+		}
+
+		reuse_deinterlacer.set_strength(strength);
+		reuse_deinterlacer.process(frame, view);
+
+		check_output("reused mask");
+	}
+
+	// Finding the rects must not change the output
+	Deinterlacer deinterlacer(width, height);
+
+	deinterlacer.set_find_rects(true);
+	deinterlacer.process(frame, view);
+
+	check_hash(image,
+	           "rects (Deinterlacer)",
+	           hash_container(deinterlacer.rects()),
+	           hashes.rects);
+
+	check_hash(image,
+	           "subtle output (Deinterlacer, rects)",
+	           hash_container(pixels),
+	           hashes.output[(int)Strength::Subtle]);
+
+	pixels = input;
+	deinterlacer.process_in_place(view);
+
+	check_hash(image,
+	           "rects (Deinterlacer, in place)",
+	           hash_container(deinterlacer.rects()),
+	           hashes.rects);
+}
+
+// BT.601 limited range
+static uint8_t rgb_to_y(const int r, const int g, const int b)
+{
+	return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static uint8_t rgb_to_u(const int r, const int g, const int b)
+{
+	return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static uint8_t rgb_to_v(const int r, const int g, const int b)
+{
+	return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Planar YUV version of an RGBA frame. The 4:2:0 chroma samples are taken
+// from the top left pixel of every 2x2 block.
+static std::vector<uint8_t> rgba_to_yuv(const FrameView& frame,
+                                        const Y4mStream& stream)
+{
+	std::vector<uint8_t> data(y4m_frame_size(stream));
+
+	const auto yuv = y4m_frame_view(stream, data);
+
+	auto convert = [&](const PlaneView& plane, const int step, auto func) {
+		for (auto y = 0; y < plane.height; ++y) {
+			const auto src = frame.pixels + y * step * frame.pitch;
+
+			for (auto x = 0; x < plane.width; ++x) {
+				const auto pixel = src[x * step];
+
+				plane.pixels[y * plane.pitch + x] =
+				        func((int)(pixel & 0xff),
+				             (int)((pixel >> 8) & 0xff),
+				             (int)((pixel >> 16) & 0xff));
+			}
+		}
+	};
+
+	const auto yuv444 = (stream.subsampling == ChromaSubsampling::Yuv444);
+
+	const auto chroma_step = yuv444 ? 1 : 2;
+
+	convert(yuv.y, 1, rgb_to_y);
+	convert(yuv.u, chroma_step, rgb_to_u);
+	convert(yuv.v, chroma_step, rgb_to_v);
+
+	return data;
+}
+
+// Copy of a frame with every other row blacked out in two rectangles, the
+// way new FMV windows would appear in it
+static std::vector<uint32_t> add_interlaced_rects(const FrameView& frame)
+{
+	std::vector<uint32_t> pixels(frame.pixels,
+	                             frame.pixels +
+	                                     (size_t)frame.width * frame.height);
+
+	auto add_rect = [&](const int x0, const int y0, const int x1,
+	                    const int y1) {
+		for (auto y = y0 + 1; y < y1; y += 2) {
+			std::fill_n(pixels.begin() + y * frame.width + x0,
+			            x1 - x0,
+			            0);
+		}
+	};
+
+	const auto w = frame.width;
+	const auto h = frame.height;
+
+	add_rect(w / 8, h / 8, w * 3 / 8, h * 3 / 8);
+	add_rect(w * 5 / 8, h * 5 / 8, w * 7 / 8, h * 7 / 8);
+
+	return pixels;
+}
+
+// The YUV pipeline with a reused mask (TemporalMask) must give the same
+// result as building the mask from scratch. `reuse_deinterlacer` is shared
+// by all images, so the mask gets updated from a different frame, an
+// identical one, and one with a few local changes.
+static void check_yuv_mask_reuse(const std::string& image,
+                                 const FrameView& frame,
+                                 const ChromaSubsampling subsampling,
+                                 Deinterlacer& reuse_deinterlacer)
+{
+	Y4mStream stream = {};
+
+	stream.width       = frame.width;
+	stream.height      = frame.height;
+	stream.subsampling = subsampling;
+
+	const auto format = (subsampling == ChromaSubsampling::Yuv420) ? "4:2:0"
+	                                                               : "4:4:4";
+
+	auto changed = add_interlaced_rects(frame);
+
+	const std::vector<uint8_t> inputs[] = {
+	        rgba_to_yuv(frame, stream),
+	        rgba_to_yuv(frame, stream),
+	        rgba_to_yuv(frame_view(changed, frame.width, frame.height),
+	                    stream)};
+
+	for (auto i = 0; i < 3; ++i) {
+		auto expected = inputs[i];
+		{
+			Deinterlacer deinterlacer(frame.width, frame.height);
+			deinterlacer.process_in_place(
+			        y4m_frame_view(stream, expected));
+		}
+		if (expected == inputs[i]) {
+			fail("%s: %s output of frame %d is the same as the "
+			     "input",
+			     image.c_str(),
+			     format,
+			     i);
+		}
+
+		auto data = inputs[i];
+		reuse_deinterlacer.process_in_place(
+		        y4m_frame_view(stream, data));
+
+		if (data != expected) {
+			fail("%s: %s output of frame %d with reused mask "
+			     "differs from the full recompute",
+			     image.c_str(),
+			     format,
+			     i);
+		}
+	}
+}
+
+static void run_image_tests(const std::string& images_dir,
+                            const bool print_hashes)
+{
+	Deinterlacer reuse_deinterlacer(0, 0);
+
+	reuse_deinterlacer.set_num_threads(2);
+	reuse_deinterlacer.set_reuse_mask(true);
+
+	Deinterlacer reuse_yuv420_deinterlacer(0, 0);
+	Deinterlacer reuse_yuv444_deinterlacer(0, 0);
+
+	for (auto deinterlacer :
+	     {&reuse_yuv420_deinterlacer, &reuse_yuv444_deinterlacer}) {
+		deinterlacer->set_num_threads(2);
+		deinterlacer->set_reuse_mask(true);
+	}
+
+	for (const auto& golden : GoldenImages) {
+		const auto path = images_dir + "/" + golden.filename;
+
+		std::vector<uint32_t> pixels;
+
+		int width  = 0;
+		int height = 0;
+
+		if (!load_image(path.c_str(), pixels, width, height)) {
+			fail("%s: error loading image file", path.c_str());
+			continue;
+		}
+		const auto frame  = frame_view(pixels, width, height);
+		const auto hashes = compute_image_hashes(frame);
+
+		if (print_hashes) {
+			print_golden_hashes(golden.filename, hashes);
+			continue;
+		}
+		check_golden_hashes(golden.filename, hashes, golden.hashes);
+
+		check_pipeline_variants(golden.filename,
+		                        frame,
+		                        hashes,
+		                        reuse_deinterlacer);
+
+		check_yuv_mask_reuse(golden.filename,
+		                     frame,
+		                     ChromaSubsampling::Yuv420,
+		                     reuse_yuv420_deinterlacer);
+
+		check_yuv_mask_reuse(golden.filename,
+		                     frame,
+		                     ChromaSubsampling::Yuv444,
+		                     reuse_yuv444_deinterlacer);
+	}
+}
+
+// A 4:2:0 chroma sample must be blended once when any of the four luma
+// pixels it covers gets filled, and not when they're masked but not black
+// or in the first row. Also when the rows are split into two ranges at an
+// odd row, and in the single luma row chroma row of an odd height.
+static void run_yuv420_chroma_tests()
+{
+	Y4mStream stream = {};
+
+	stream.width  = 64;
+	stream.height = 5;
+
+	const auto layout = make_mask_layout(stream.width, stream.height);
+
+	FrameMask mask(layout);
+
+	constexpr uint8_t Black = 16;
+	constexpr uint8_t Image = 100;
+
+	std::vector<uint8_t> input(y4m_frame_size(stream), Image);
+
+	const auto chroma_size = (input.size() - 64 * 5) / 2;
+	std::fill_n(input.end() - 2 * chroma_size, chroma_size, 168);
+	std::fill_n(input.end() - chroma_size, chroma_size, 88);
+
+	auto add_pixel = [&](const int x, const int y, const uint8_t luma) {
+		mask.mask[layout.offset + layout.pitch * (y + 1)] |= 1ull << x;
+		input[y * 64 + x] = luma;
+	};
+	add_pixel(5, 0, Black);
+	add_pixel(1, 1, Image);
+	add_pixel(62, 2, Black);
+	add_pixel(63, 4, Black);
+
+	find_occupied_rows(layout, mask.mask, mask.occupancy, layout.height);
+
+	// The black pixels below the first row get the image row above them,
+	// and their chroma samples twice the delta with the full strength
+	auto expected = input;
+	{
+		const auto frame = y4m_frame_view(stream, expected);
+
+		for (const auto& [x, y] : {std::pair{62, 2}, std::pair{63, 4}}) {
+			frame.y.pixels[y * frame.y.pitch + x] = Image;
+			frame.u.pixels[y / 2 * frame.u.pitch + x / 2] = 208;
+			frame.v.pixels[y / 2 * frame.v.pitch + x / 2] = 48;
+		}
+	}
+
+	auto whole = input;
+	deinterlace_yuv_rows_in_place(layout,
+	                              y4m_frame_view(stream, whole),
+	                              mask.mask,
+	                              mask.occupancy,
+	                              0,
+	                              layout.height,
+	                              0,
+	                              nullptr,
+	                              Strength::Full);
+
+	if (whole != expected) {
+		fail("4:2:0 chroma blend gives the wrong result");
+	}
+
+	// The second range reads the filled row 2 from the copy of the row
+	// above it
+	auto split = input;
+	for (const auto& [first_row, last_row] :
+	     {std::pair{0, 3}, std::pair{3, layout.height}}) {
+		deinterlace_yuv_rows_in_place(layout,
+		                              y4m_frame_view(stream, split),
+		                              mask.mask,
+		                              mask.occupancy,
+		                              first_row,
+		                              last_row,
+		                              0,
+		                              (first_row > 0)
+		                                      ? input.data() +
+		                                                (first_row - 1) * 64
+		                                      : nullptr,
+		                              Strength::Full);
+	}
+	if (split != expected) {
+		fail("4:2:0 chroma blend split at an odd row gives the wrong "
+		     "result");
+	}
+}
+
+// Y4M streams with a few frames each, in both supported chroma formats. The
+// parameters we don't parse must survive the round trip.
+struct Y4mTest {
+	const char* header = nullptr;
+
+	int width  = 0;
+	int height = 0;
+
+	ChromaSubsampling subsampling = ChromaSubsampling::Yuv420;
+	bool full_range               = false;
+};
+
+constexpr Y4mTest Y4mTests[] = {
+        {"YUV4MPEG2 W64 H4 F30000:1001 Ip A1:1 C420jpeg XYSCSS=420JPEG",
+         64,
+         4,
+         ChromaSubsampling::Yuv420,
+         false},
+        {"YUV4MPEG2 C420mpeg2 H5 W192",
+         192,
+         5,
+         ChromaSubsampling::Yuv420,
+         false},
+        {"YUV4MPEG2 W128 H3 F25:1 It C444 XCOLORRANGE=FULL",
+         128,
+         3,
+         ChromaSubsampling::Yuv444,
+         true},
+};
+
+// Writes streams with the Y4M writer and reads them back
+static void run_y4m_tests()
+{
+	std::mt19937_64 random(1);
+
+	for (const auto& test : Y4mTests) {
+		const auto name = std::string("Y4M '") + test.header + "'";
+
+		Y4mStream stream = {};
+
+		stream.width       = test.width;
+		stream.height      = test.height;
+		stream.subsampling = test.subsampling;
+		stream.full_range  = test.full_range;
+		stream.header      = test.header;
+
+		const std::string frame_headers[] = {"FRAME",
+		                                     "FRAME Ib",
+		                                     "FRAME"};
+
+		std::vector<std::vector<uint8_t>> frames;
+
+		for (auto i = 0; i < 3; ++i) {
+			auto& data = frames.emplace_back(y4m_frame_size(stream));
+			std::generate(data.begin(), data.end(), [&] {
+				return (uint8_t)random();
+			});
+		}
+
+		auto file = tmpfile();
+		if (!file) {
+			fail("%s: error creating temporary file", name.c_str());
+			return;
+		}
+
+		auto written = write_y4m_header(file, stream);
+		for (auto i = 0; i < 3; ++i) {
+			written = written && write_y4m_frame(file,
+			                                     frame_headers[i],
+			                                     frames[i]);
+		}
+		if (!written) {
+			fail("%s: error writing stream", name.c_str());
+		}
+		rewind(file);
+
+		Y4mStream read = {};
+
+		if (!read_y4m_header(file, read)) {
+			fail("%s: error reading stream header", name.c_str());
+			fclose(file);
+			continue;
+		}
+		if (read.width != test.width || read.height != test.height ||
+		    read.subsampling != test.subsampling ||
+		    read.full_range != test.full_range ||
+		    read.header != test.header) {
+			fail("%s: stream header read back differently",
+			     name.c_str());
+		}
+
+		std::string frame_header = {};
+		std::vector<uint8_t> data(y4m_frame_size(read));
+
+		for (auto i = 0; i < 3; ++i) {
+			const auto result = read_y4m_frame(file,
+			                                   read,
+			                                   frame_header,
+			                                   data);
+
+			if (result != Y4mReadResult::Ok) {
+				fail("%s: error reading frame %d",
+				     name.c_str(),
+				     i);
+				break;
+			}
+			if (frame_header != frame_headers[i] ||
+			    data != frames[i]) {
+				fail("%s: frame %d read back differently",
+				     name.c_str(),
+				     i);
+			}
+		}
+		if (read_y4m_frame(file, read, frame_header, data) !=
+		    Y4mReadResult::EndOfStream) {
+			fail("%s: no end of stream after the last frame",
+			     name.c_str());
+		}
+		fclose(file);
+	}
+}
+
+static const char* isa_name(const KernelIsa isa)
+{
+	return (isa == KernelIsa::Avx2) ? "AVX2" : "AVX-512";
+}
+
+// Runs `run` with the scalar kernels and the kernels of `isa`, and checks
+// that it returns the same bytes. `run` must start from the same inputs
+// every time.
+template <typename Run>
+static void compare_with_scalar(const KernelIsa isa, const std::string& test,
+                                Run run)
+{
+	set_kernel_isa(KernelIsa::Scalar);
+	const std::vector<uint8_t> expected = run();
+
+	set_kernel_isa(isa);
+	const std::vector<uint8_t> actual = run();
+
+	if (actual == expected) {
+		return;
+	}
+	const auto mismatch = std::mismatch(actual.begin(),
+	                                    actual.end(),
+	                                    expected.begin(),
+	                                    expected.end());
+
+	fail("%s: %s result differs from the scalar one at byte %zu",
+	     test.c_str(),
+	     isa_name(isa),
+	     (size_t)(mismatch.first - actual.begin()));
+}
+
+// Black pixels with random alpha, pixels with a single channel just above
+// black, and random pixels
+static std::vector<uint32_t> random_pixels(std::mt19937_64& random,
+                                           const size_t num_pixels)
+{
+	std::vector<uint32_t> pixels(num_pixels);
+
+	for (auto& pixel : pixels) {
+		const auto value = (uint32_t)random();
+		const auto kind  = random() % 4;
+
+		if (kind == 0) {
+			pixel = value & 0xff000000;
+		} else if (kind == 1) {
+			const auto channel = (int)(random() % 3);
+			pixel = (value & 0xff000000) | (1u << (channel * 8));
+		} else {
+			pixel = value;
+		}
+	}
+	return pixels;
+}
+
+// Half of the samples within two levels of the black level, so both sides of
+// the compare get plenty of values close to it
+static std::vector<uint8_t> random_luma(std::mt19937_64& random,
+                                        const size_t num_samples,
+                                        const int black_level)
+{
+	std::vector<uint8_t> samples(num_samples);
+
+	for (auto& sample : samples) {
+		const auto value = random();
+
+		if (value % 2) {
+			const auto offset = (int)((value >> 8) % 5) - 2;
+			sample = (uint8_t)std::clamp(black_level + offset, 0, 255);
+		} else {
+			sample = (uint8_t)(value >> 8);
+		}
+	}
+	return samples;
+}
+
+// Mask words from empty to full and everything in between, so the blends
+// run both their bit walk and their dense kernels. Some rows are left empty
+// to exercise the occupancy skipping.
+static void random_mask(std::mt19937_64& random, const MaskLayout& layout,
+                        FrameMask& frame_mask)
+{
+	for (auto y = 0; y < layout.height; ++y) {
+		const auto row = frame_mask.mask.data() + layout.offset +
+		                 layout.pitch * (y + 1);
+
+		const auto empty_row = (random() % 4 == 0);
+
+		for (auto x = 0; x < layout.width / 64; ++x) {
+			const auto kind = empty_row ? 0 : random() % 6;
+
+			uint64_t word = 0;
+
+			if (kind == 1) {
+				word = ~0ull;
+			} else if (kind == 2) {
+				word = random();
+			} else if (kind == 3) {
+				word = random() & random() & random();
+			} else if (kind == 4) {
+				word = random() | random();
+			} else if (kind == 5) {
+				word = 1ull << (random() % 64);
+			}
+			row[x] = word;
+		}
+	}
+	find_occupied_rows(layout,
+	                   frame_mask.mask,
+	                   frame_mask.occupancy,
+	                   layout.height);
+}
+
+struct TestSize {
+	int width  = 0;
+	int height = 0;
+};
+
+constexpr TestSize TestSizes[] = {{64, 3}, {640, 67}, {1984, 130}};
+
+static void run_mask_kernel_tests(const KernelIsa isa, const TestSize size,
+                                  std::mt19937_64& random)
+{
+	const auto width  = size.width;
+	const auto height = size.height;
+	const auto layout = make_mask_layout(width, height);
+
+	const auto name = std::to_string(width) + "x" + std::to_string(height);
+
+	auto input = random_pixels(random, (size_t)width * height);
+	const auto src = frame_view(input, width, height);
+
+	compare_with_scalar(isa, "threshold " + name, [&] {
+		FrameMask result(layout);
+		threshold(layout, src, result.mask);
+
+		return result.bytes();
+	});
+
+	compare_with_scalar(isa, "threshold_and_xor " + name, [&] {
+		FrameMask result(layout);
+		MaskBuffer prev_line(width / 64);
+
+		threshold_and_xor(layout,
+		                  src,
+		                  result.mask,
+		                  result.occupancy,
+		                  prev_line,
+		                  0,
+		                  height);
+
+		return result.bytes();
+	});
+
+	for (const auto black_level : {0, 16, 235}) {
+		auto samples = random_luma(random, input.size(), black_level);
+
+		const PlaneView luma = {samples.data(), width, height, width};
+
+		const auto test = "threshold_luma_and_xor " + name +
+		                  ", black level " + std::to_string(black_level);
+
+		compare_with_scalar(isa, test, [&] {
+			FrameMask result(layout);
+			MaskBuffer prev_line(width / 64);
+
+			threshold_luma_and_xor(layout,
+			                       luma,
+			                       (uint8_t)black_level,
+			                       result.mask,
+			                       result.occupancy,
+			                       prev_line,
+			                       0,
+			                       height);
+
+			return result.bytes();
+		});
+	}
+}
+
+static void run_blend_kernel_tests(const KernelIsa isa, const TestSize size,
+                                   std::mt19937_64& random)
+{
+	const auto width  = size.width;
+	const auto height = size.height;
+	const auto layout = make_mask_layout(width, height);
+
+	auto input = random_pixels(random, (size_t)width * height);
+	const auto src = frame_view(input, width, height);
+
+	FrameMask mask(layout);
+	random_mask(random, layout, mask);
+
+	std::vector<uint8_t> yuv_inputs[2];
+
+	Y4mStream yuv_streams[2] = {};
+
+	for (auto i = 0; i < 2; ++i) {
+		auto& stream = yuv_streams[i];
+
+		stream.width       = width;
+		stream.height      = height;
+		stream.subsampling = (i == 0) ? ChromaSubsampling::Yuv420
+		                              : ChromaSubsampling::Yuv444;
+
+		// Only black luma samples are changed by the blend
+		auto& data = yuv_inputs[i];
+
+		data = random_luma(random, y4m_frame_size(stream), 16);
+		std::generate(data.begin() + input.size(), data.end(), [&] {
+			return (uint8_t)random();
+		});
+	}
+
+	for (auto i = 0; i < NumStrengths; ++i) {
+		const auto strength = (Strength)i;
+
+		const auto name = std::to_string(width) + "x" +
+		                  std::to_string(height) + ", " + StrengthNames[i];
+
+		compare_with_scalar(isa, "deinterlace " + name, [&] {
+			std::vector<uint32_t> output(input.size());
+
+			deinterlace(layout,
+			            src,
+			            mask.mask,
+			            mask.occupancy,
+			            frame_view(output, width, height),
+			            strength);
+
+			std::vector<uint8_t> bytes;
+			append_bytes(bytes, output);
+			return bytes;
+		});
+
+		compare_with_scalar(isa, "deinterlace_in_place " + name, [&] {
+			auto pixels = input;
+
+			deinterlace_in_place(layout,
+			                     frame_view(pixels, width, height),
+			                     mask.mask,
+			                     mask.occupancy,
+			                     strength);
+
+			std::vector<uint8_t> bytes;
+			append_bytes(bytes, pixels);
+			return bytes;
+		});
+
+		for (auto n = 0; n < 2; ++n) {
+			const auto test = "deinterlace_yuv_rows_in_place " + name +
+			                  ((n == 0) ? ", 4:2:0" : ", 4:4:4");
+
+			compare_with_scalar(isa, test, [&] {
+				auto data = yuv_inputs[n];
+
+				deinterlace_yuv_rows_in_place(
+				        layout,
+				        y4m_frame_view(yuv_streams[n], data),
+				        mask.mask,
+				        mask.occupancy,
+				        0,
+				        height,
+				        0,
+				        nullptr,
+				        strength);
+
+				return data;
+			});
+		}
+	}
+}
+
+// The whole pipeline on frames that look like the real thing
+static void run_pipeline_kernel_tests(const KernelIsa isa)
+{
+	for (uint32_t seed = 1; seed <= 8; ++seed) {
+		SyntheticFrameParams params = {};
+
+		params.seed          = seed;
+		params.num_fmv_rects = (int)(seed % 3) + 1;
+		params.fmv_coverage  = (float)(seed % 4 + 1) / 5;
+		params.fmv_density   = (float)(seed % 5 + 1) / 5;
+
+		std::vector<uint32_t> input;
+		generate_synthetic_frame(params, input);
+
+		const auto width  = params.width;
+		const auto height = params.height;
+
+		const auto test = "Deinterlacer, synthetic frame " +
+		                  std::to_string(seed);
+
+		compare_with_scalar(isa, test, [&] {
+			Deinterlacer deinterlacer(width, height);
+			deinterlacer.set_num_threads(3);
+
+			std::vector<uint32_t> output(input.size());
+
+			deinterlacer.process(frame_view(input, width, height),
+			                     frame_view(output, width, height));
+
+			std::vector<uint8_t> bytes;
+			append_bytes(bytes, output);
+			return bytes;
+		});
+	}
+}
+
+// Widths that aren't a multiple of 64 must be rejected, not truncated
+static void run_frame_size_tests()
+{
+	auto throws_invalid_argument = [](auto func) {
+		try {
+			func();
+		} catch (const std::invalid_argument&) {
+			return true;
+		}
+		return false;
+	};
+
+	if (!throws_invalid_argument([] { Deinterlacer deinterlacer(100, 4); })) {
+		fail("Deinterlacer accepts a width of 100");
+	}
+
+	std::vector<uint32_t> pixels(100 * 4);
+	const auto frame = frame_view(pixels, 100, 4);
+
+	Deinterlacer deinterlacer(64, 4);
+
+	if (!throws_invalid_argument([&] { deinterlacer.process(frame, frame); }) ||
+	    !throws_invalid_argument([&] { deinterlacer.process_in_place(frame); })) {
+		fail("Deinterlacer processes a frame with a width of 100");
+	}
+}
+
+// A hash match alone must not return the output of a different frame
+static void run_frame_cache_tests()
+{
+	constexpr auto FrameSize = 64;
+
+	std::vector<uint8_t> frame1(FrameSize, 1);
+	std::vector<uint8_t> frame2(FrameSize, 2);
+
+	FrameCache cache(FrameSize, 2);
+
+	const uint64_t hash = 42;
+
+	std::fill_n(cache.insert(hash, frame1.data()), FrameSize, 0xa5);
+
+	const auto output = cache.find(hash, frame1.data());
+	if (!output || output[0] != 0xa5) {
+		fail("frame cache: cached frame not found");
+	}
+	if (cache.find(hash, frame2.data())) {
+		fail("frame cache: colliding frame returned the cached output");
+	}
+}
+
+// Inputs that map to the same output file must be rejected
+static void run_output_name_tests()
+{
+	if (!check_output_file_names({"x/a.png", "x/b.png", "x/c.jpg"})) {
+		fail("distinct output names rejected");
+	}
+
+	// Both report the clash on stderr
+	if (check_output_file_names({"x/a.png", "x/b.png", "x/a.jpg"})) {
+		fail("a.png and a.jpg output name clash not detected");
+	}
+	if (check_output_file_names({"x/a.png", "y/a.png"})) {
+		fail("x/a.png and y/a.png output name clash not detected");
+	}
+}
+
+static void run_kernel_tests(const KernelIsa isa)
+{
+	// Same inputs for every instruction set
+	std::mt19937_64 random(1);
+
+	for (const auto size : TestSizes) {
+		run_mask_kernel_tests(isa, size, random);
+		run_blend_kernel_tests(isa, size, random);
+	}
+	run_pipeline_kernel_tests(isa);
+
+	set_kernel_isa(KernelIsa::Auto);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string images_dir = {};
+	auto print_hashes      = false;
+
+	for (auto i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+
+		if (arg == "--print-hashes") {
+			print_hashes = true;
+		} else if (images_dir.empty() && !arg.starts_with("--")) {
+			images_dir = arg;
+		} else {
+			images_dir.clear();
+			break;
+		}
+	}
+	if (images_dir.empty()) {
+		printf("Usage: deinterlace_tests IMAGES_DIR [--print-hashes]\n");
+		return EXIT_FAILURE;
+	}
+
+	run_image_tests(images_dir, print_hashes);
+
+	if (print_hashes) {
+		return (num_failures > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	run_yuv420_chroma_tests();
+	run_y4m_tests();
+	run_frame_size_tests();
+	run_frame_cache_tests();
+	run_output_name_tests();
+
+	for (const auto isa : {KernelIsa::Avx2, KernelIsa::Avx512}) {
+		if (!set_kernel_isa(isa)) {
+			printf("Skipping the %s kernels (not supported by this CPU)\n",
+			       isa_name(isa));
+			continue;
+		}
+		run_kernel_tests(isa);
+	}
+
+	if (num_failures > 0) {
+		printf("%d checks failed\n", num_failures);
+		return EXIT_FAILURE;
+	}
+	printf("All tests passed\n");
+	return EXIT_SUCCESS;
+}
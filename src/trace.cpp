@@ -0,0 +1,170 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> trace_enabled = false;
+
+struct TraceEvent {
+	const char* name = nullptr;
+	int64_t frame    = -1;
+	uint64_t begin   = 0;
+	uint64_t end     = 0;
+};
+
+// Ring buffer of the spans of one thread. Only its own thread writes to it.
+struct ThreadTrace {
+	int tid          = 0;
+	std::string name = {};
+
+	std::vector<TraceEvent> events = {};
+
+	// Total number of spans recorded; the oldest ones get overwritten when
+	// it's larger than the size of the buffer
+	uint64_t num_recorded = 0;
+};
+
+// The buffers are never freed, so the spans of exited threads can still be
+// written out
+static std::mutex trace_mutex                                  = {};
+static std::vector<std::unique_ptr<ThreadTrace>> trace_threads = {};
+
+static uint64_t trace_start = 0;
+
+static thread_local ThreadTrace* thread_trace = nullptr;
+
+uint64_t trace_clock()
+{
+	const auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+	        .count();
+}
+
+void enable_tracing()
+{
+	trace_start = trace_clock();
+	trace_enabled.store(true, std::memory_order_release);
+}
+
+// Buffer of the calling thread, registered on first use
+static ThreadTrace& get_thread_trace()
+{
+	if (!thread_trace) {
+		auto trace = std::make_unique<ThreadTrace>();
+		trace->events.resize(TraceBufferSize);
+
+		std::lock_guard lock(trace_mutex);
+
+		trace->tid   = (int)trace_threads.size() + 1;
+		thread_trace = trace.get();
+
+		trace_threads.emplace_back(std::move(trace));
+	}
+	return *thread_trace;
+}
+
+void set_trace_thread_name(const std::string& name)
+{
+	if (tracing_enabled()) {
+		get_thread_trace().name = name;
+	}
+}
+
+void record_trace_span(const char* name, const int64_t frame,
+                       const uint64_t begin)
+{
+	const auto end = trace_clock();
+
+	auto& trace = get_thread_trace();
+
+	trace.events[trace.num_recorded % TraceBufferSize] = {name,
+	                                                       frame,
+	                                                       begin,
+	                                                       end};
+	++trace.num_recorded;
+}
+
+// Thread names are the only strings that don't come from the code
+static void write_json_string(FILE* file, const std::string& s)
+{
+	fputc('"', file);
+
+	for (const auto c : s) {
+		if (c == '"' || c == '\\') {
+			fputc('\\', file);
+			fputc(c, file);
+		} else if ((unsigned char)c < 0x20) {
+			fprintf(file, "\\u%04x", c);
+		} else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+// Microseconds since enable_tracing()
+static double trace_micros(const uint64_t time)
+{
+	return (double)(int64_t)(time - trace_start) / 1000.0;
+}
+
+bool write_trace(const char* filename)
+{
+	auto file = fopen(filename, "w");
+	if (!file) {
+		return false;
+	}
+
+	std::lock_guard lock(trace_mutex);
+
+	fprintf(file, "{\"traceEvents\":[\n");
+
+	fprintf(file,
+	        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+	        "\"args\":{\"name\":\"deinterlace\"}}");
+
+	for (const auto& trace : trace_threads) {
+		if (!trace->name.empty()) {
+			fprintf(file,
+			        ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			        "\"tid\":%d,\"args\":{\"name\":",
+			        trace->tid);
+			write_json_string(file, trace->name);
+			fprintf(file, "}}");
+		}
+
+		// Oldest first
+		const auto num_events = std::min(trace->num_recorded,
+		                                 (uint64_t)TraceBufferSize);
+
+		for (auto i = trace->num_recorded - num_events;
+		     i < trace->num_recorded;
+		     ++i) {
+			const auto& event = trace->events[i % TraceBufferSize];
+
+			fprintf(file,
+			        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+			        "\"ts\":%.3f,\"dur\":%.3f",
+			        event.name,
+			        trace->tid,
+			        trace_micros(event.begin),
+			        (double)(event.end - event.begin) / 1000.0);
+
+			if (event.frame >= 0) {
+				fprintf(file,
+				        ",\"args\":{\"frame\":%lld}",
+				        (long long)event.frame);
+			}
+			fprintf(file, "}");
+		}
+	}
+
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	const auto ok = !ferror(file);
+	return (fclose(file) == 0) && ok;
+}
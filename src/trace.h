@@ -0,0 +1,74 @@
+#ifndef FMV_DEINTERLACE_TRACE_H
+#define FMV_DEINTERLACE_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timeline tracing of the pipeline stages. Every thread records the begin
+// and end times of its spans into its own ring buffer, which keeps the most
+// recent TraceBufferSize spans, and write_trace() dumps all buffers as
+// Chrome trace event JSON that can be opened in Perfetto
+// (ui.perfetto.dev) or chrome://tracing.
+//
+// Tracing is off until enable_tracing() is called. While it's off, a span
+// costs a relaxed atomic load and a branch, and no buffers are allocated.
+
+// Spans kept per thread
+constexpr auto TraceBufferSize = 1 << 16;
+
+extern std::atomic<bool> trace_enabled;
+
+inline bool tracing_enabled()
+{
+	return trace_enabled.load(std::memory_order_relaxed);
+}
+
+// Turns on tracing for all threads. Timestamps are relative to the time of
+// the call.
+void enable_tracing();
+
+// Names the calling thread in the trace. Does nothing if tracing is off, so
+// it must be called after enable_tracing().
+void set_trace_thread_name(const std::string& name);
+
+// Writes the spans of all threads, including the ones that have exited, to
+// a Chrome trace event JSON file. No spans must be recorded while writing.
+bool write_trace(const char* filename);
+
+uint64_t trace_clock();
+
+void record_trace_span(const char* name, const int64_t frame,
+                       const uint64_t begin);
+
+// Records the lifetime of the object as a span of the calling thread.
+// `name` must be a string literal (only the pointer is stored), and `frame`
+// is shown as an argument of the span unless it's negative.
+class TraceSpan {
+public:
+	explicit TraceSpan(const char* _name, const int64_t _frame = -1)
+	{
+		if (tracing_enabled()) {
+			name  = _name;
+			frame = _frame;
+			begin = trace_clock();
+		}
+	}
+
+	~TraceSpan()
+	{
+		if (name) {
+			record_trace_span(name, frame, begin);
+		}
+	}
+
+	TraceSpan(const TraceSpan&)            = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* name = nullptr;
+	int64_t frame    = -1;
+	uint64_t begin   = 0;
+};
+
+#endif // FMV_DEINTERLACE_TRACE_H
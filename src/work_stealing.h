@@ -0,0 +1,100 @@
+#ifndef FMV_DEINTERLACE_WORK_STEALING_H
+#define FMV_DEINTERLACE_WORK_STEALING_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Runs `task(worker, index)` for every index from 0 to num_tasks - 1 on
+// `num_workers` threads, and returns when all of them are done.
+//
+// Every worker starts with its own contiguous range of indices, so with
+// tasks that are image files sorted by name, neighbouring frames of a
+// sequence tend to be processed by the same worker one after the other.
+// Workers take tasks from the front of their own queue, and when they run
+// out, steal from the back of the queues of the others. This keeps all
+// workers busy even if the tasks take very different amounts of time.
+//
+// `worker` is in the range 0 to num_workers - 1, so tasks can keep
+// per-worker state in a vector indexed by it.
+template <typename Task>
+void run_work_stealing(const int num_workers, const size_t num_tasks,
+                       Task task)
+{
+	struct WorkerQueue {
+		std::mutex mutex         = {};
+		std::deque<size_t> tasks = {};
+	};
+
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+	for (auto worker = 0; worker < num_workers; ++worker) {
+		auto queue = std::make_unique<WorkerQueue>();
+
+		const auto first = num_tasks * worker / num_workers;
+		const auto last  = num_tasks * (worker + 1) / num_workers;
+
+		for (auto index = first; index < last; ++index) {
+			queue->tasks.push_back(index);
+		}
+		queues.emplace_back(std::move(queue));
+	}
+
+	auto take_own = [&](const int worker) -> std::optional<size_t> {
+		auto& queue = *queues[worker];
+		std::lock_guard lock(queue.mutex);
+
+		if (queue.tasks.empty()) {
+			return {};
+		}
+		const auto index = queue.tasks.front();
+		queue.tasks.pop_front();
+		return index;
+	};
+
+	auto steal = [&](const int worker) -> std::optional<size_t> {
+		for (auto i = 1; i < num_workers; ++i) {
+			auto& victim = *queues[(worker + i) % num_workers];
+			std::lock_guard lock(victim.mutex);
+
+			if (!victim.tasks.empty()) {
+				const auto index = victim.tasks.back();
+				victim.tasks.pop_back();
+				return index;
+			}
+		}
+		return {};
+	};
+
+	// No new tasks are added, so once a worker finds all queues empty
+	// there's nothing left for it to do
+	auto run_worker = [&](const int worker) {
+		for (;;) {
+			auto index = take_own(worker);
+			if (!index) {
+				index = steal(worker);
+			}
+			if (!index) {
+				return;
+			}
+			task(worker, *index);
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (auto worker = 1; worker < num_workers; ++worker) {
+		threads.emplace_back(run_worker, worker);
+	}
+	run_worker(0);
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+#endif // FMV_DEINTERLACE_WORK_STEALING_H
@@ -0,0 +1,183 @@
+#include "y4m.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// Long enough for any sane header; protects us from reading a whole binary
+// file into a string when it isn't a Y4M stream
+constexpr auto MaxHeaderLength = 4096;
+
+// Reads a line without the terminating newline. Returns false at EOF before
+// the first character, on read errors, and for overlong lines.
+static bool read_line(FILE* in, std::string& line)
+{
+	line.clear();
+
+	for (;;) {
+		const auto c = fgetc(in);
+		if (c == EOF) {
+			return false;
+		}
+		if (c == '\n') {
+			return true;
+		}
+		if ((int)line.size() == MaxHeaderLength) {
+			return false;
+		}
+		line.push_back((char)c);
+	}
+}
+
+static bool parse_chroma(const std::string& value,
+                         ChromaSubsampling& subsampling)
+{
+	if (value == "420" || value == "420jpeg" || value == "420mpeg2" ||
+	    value == "420paldv") {
+		subsampling = ChromaSubsampling::Yuv420;
+		return true;
+	}
+	if (value == "444") {
+		subsampling = ChromaSubsampling::Yuv444;
+		return true;
+	}
+	return false;
+}
+
+bool read_y4m_header(FILE* in, Y4mStream& stream)
+{
+	constexpr auto Magic = "YUV4MPEG2";
+
+	if (!read_line(in, stream.header) || !stream.header.starts_with(Magic)) {
+		fprintf(stderr, "Input is not a YUV4MPEG2 stream\n");
+		return false;
+	}
+
+	// Parameters are separated by single spaces; the first letter tells
+	// what they are
+	size_t pos = strlen(Magic);
+
+	while (pos < stream.header.size()) {
+		const auto start = pos + 1;
+
+		auto end = stream.header.find(' ', start);
+		if (end == std::string::npos) {
+			end = stream.header.size();
+		}
+		pos = end;
+
+		if (start >= end) {
+			continue;
+		}
+		const auto tag   = stream.header[start];
+		const auto value = stream.header.substr(start + 1, end - start - 1);
+
+		if (tag == 'W') {
+			stream.width = atoi(value.c_str());
+		} else if (tag == 'H') {
+			stream.height = atoi(value.c_str());
+		} else if (tag == 'C') {
+			if (!parse_chroma(value, stream.subsampling)) {
+				fprintf(stderr,
+				        "Unsupported Y4M colour space 'C%s' (only "
+				        "8-bit 4:2:0 and 4:4:4 are supported)\n",
+				        value.c_str());
+				return false;
+			}
+		} else if (tag == 'X' && value == "COLORRANGE=FULL") {
+			stream.full_range = true;
+		}
+	}
+
+	if (stream.width <= 0 || stream.height <= 0) {
+		fprintf(stderr, "Invalid Y4M frame size\n");
+		return false;
+	}
+	if (stream.width % FrameWidthMultiple != 0) {
+		fprintf(stderr,
+		        "Unsupported Y4M frame width %d (must be a multiple of 64)\n",
+		        stream.width);
+		return false;
+	}
+	return true;
+}
+
+bool write_y4m_header(FILE* out, const Y4mStream& stream)
+{
+	return fprintf(out, "%s\n", stream.header.c_str()) > 0;
+}
+
+static int chroma_width(const Y4mStream& stream)
+{
+	return (stream.subsampling == ChromaSubsampling::Yuv444)
+	             ? stream.width
+	             : (stream.width + 1) / 2;
+}
+
+static int chroma_height(const Y4mStream& stream)
+{
+	return (stream.subsampling == ChromaSubsampling::Yuv444)
+	             ? stream.height
+	             : (stream.height + 1) / 2;
+}
+
+size_t y4m_frame_size(const Y4mStream& stream)
+{
+	const auto luma_size   = (size_t)stream.width * stream.height;
+	const auto chroma_size = (size_t)chroma_width(stream) *
+	                         chroma_height(stream);
+
+	return luma_size + chroma_size * 2;
+}
+
+YuvFrameView y4m_frame_view(const Y4mStream& stream, std::vector<uint8_t>& data)
+{
+	const auto cw = chroma_width(stream);
+	const auto ch = chroma_height(stream);
+
+	YuvFrameView frame = {};
+
+	frame.y = {data.data(), stream.width, stream.height, stream.width};
+
+	const auto u = frame.y.pixels + (size_t)stream.width * stream.height;
+	const auto v = u + (size_t)cw * ch;
+
+	frame.u = {u, cw, ch, cw};
+	frame.v = {v, cw, ch, cw};
+
+	frame.subsampling = stream.subsampling;
+	frame.black_level = stream.full_range ? 0 : 16;
+
+	return frame;
+}
+
+Y4mReadResult read_y4m_frame(FILE* in, const Y4mStream& stream,
+                             std::string& frame_header,
+                             std::vector<uint8_t>& data)
+{
+	if (!read_line(in, frame_header)) {
+		if (feof(in) && frame_header.empty()) {
+			return Y4mReadResult::EndOfStream;
+		}
+		fprintf(stderr, "Error reading Y4M frame header\n");
+		return Y4mReadResult::Error;
+	}
+	if (!frame_header.starts_with("FRAME")) {
+		fprintf(stderr, "Invalid Y4M frame header\n");
+		return Y4mReadResult::Error;
+	}
+
+	const auto frame_size = y4m_frame_size(stream);
+
+	if (fread(data.data(), 1, frame_size, in) != frame_size) {
+		fprintf(stderr, "Truncated frame in Y4M stream\n");
+		return Y4mReadResult::Error;
+	}
+	return Y4mReadResult::Ok;
+}
+
+bool write_y4m_frame(FILE* out, const std::string& frame_header,
+                     const std::vector<uint8_t>& data)
+{
+	return fprintf(out, "%s\n", frame_header.c_str()) > 0 &&
+	       fwrite(data.data(), 1, data.size(), out) == data.size();
+}
@@ -0,0 +1,52 @@
+#ifndef FMV_DEINTERLACE_Y4M_H
+#define FMV_DEINTERLACE_Y4M_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "stages.h"
+
+// Minimal YUV4MPEG2 reader and writer for 8-bit 4:2:0 and 4:4:4 streams.
+// The stream and frame headers are passed through as they are, so all
+// parameters we don't care about (frame rate, aspect ratio, etc.) survive
+// the round trip.
+struct Y4mStream {
+	int width  = 0;
+	int height = 0;
+
+	ChromaSubsampling subsampling = ChromaSubsampling::Yuv420;
+
+	// XCOLORRANGE=FULL
+	bool full_range = false;
+
+	// The stream header line without the terminating newline
+	std::string header = {};
+};
+
+enum class Y4mReadResult { Ok, EndOfStream, Error };
+
+// Reads and parses the stream header. Returns false (and prints the reason
+// to stderr) for invalid or unsupported streams.
+bool read_y4m_header(FILE* in, Y4mStream& stream);
+
+bool write_y4m_header(FILE* out, const Y4mStream& stream);
+
+// Size of the Y, U and V planes of a frame in bytes
+size_t y4m_frame_size(const Y4mStream& stream);
+
+// Frame view of a buffer of y4m_frame_size() bytes
+YuvFrameView y4m_frame_view(const Y4mStream& stream, std::vector<uint8_t>& data);
+
+// Reads the next frame into `data`, which must hold y4m_frame_size() bytes.
+// The frame header line is stored in `frame_header`. Errors are printed to
+// stderr.
+Y4mReadResult read_y4m_frame(FILE* in, const Y4mStream& stream,
+                             std::string& frame_header,
+                             std::vector<uint8_t>& data);
+
+bool write_y4m_frame(FILE* out, const std::string& frame_header,
+                     const std::vector<uint8_t>& data);
+
+#endif // FMV_DEINTERLACE_Y4M_H